@@ -26,29 +26,179 @@ static const char *default_tags[] = {
 	QT_TRANSLATE_NOOP("gettextFromC", "deco")
 };
 
+/*
+ * The registry of event names. Dive computers only ever use a few dozen
+ * different names, so they are simply kept around until exit.
+ */
+static struct {
+	int nr, allocated;
+	const char **names;		/* indexed by name id */
+	unsigned int size;		/* number of hash slots, a power of two */
+	int *slots;			/* name ids, 0 for an empty slot */
+} event_names;
+
+static unsigned int event_name_hash(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static int *event_name_slot(const char *name)
+{
+	unsigned int i = event_name_hash(name) & (event_names.size - 1);
+
+	while (event_names.slots[i] && strcmp(event_names.names[event_names.slots[i]], name))
+		i = (i + 1) & (event_names.size - 1);
+	return event_names.slots + i;
+}
+
+static int register_event_name(const char *name)
+{
+	int id = event_names.nr;
+
+	if (id >= event_names.allocated) {
+		int allocated = event_names.allocated * 2 + 16;
+		const char **names = realloc(event_names.names, allocated * sizeof(const char *));
+		if (!names)
+			exit(1);
+		event_names.names = names;
+		event_names.allocated = allocated;
+	}
+	/* keep the hash at most half full */
+	if (2 * id >= event_names.size) {
+		int *old = event_names.slots, i;
+
+		event_names.size = event_names.size ? event_names.size * 2 : 64;
+		event_names.slots = calloc(event_names.size, sizeof(int));
+		if (!event_names.slots)
+			exit(1);
+		for (i = 1; i < id; i++)
+			*event_name_slot(event_names.names[i]) = i;
+		free(old);
+	}
+	event_names.names[id] = strdup(name);
+	event_names.nr++;
+	*event_name_slot(name) = id;
+	return id;
+}
+
+static void init_event_names(void)
+{
+	event_names.nr = 1;	/* EVENT_NAME_NONE */
+	register_event_name("gaschange");
+	register_event_name("bookmark");
+	register_event_name("heading");
+}
+
+/* the id of an event name; 0 if no event ever used it */
+int find_event_name_id(const char *name)
+{
+	if (!event_names.nr)
+		init_event_names();
+	return *event_name_slot(name);
+}
+
+int event_name_id(const char *name)
+{
+	int id = find_event_name_id(name);
+
+	return id ? id : register_event_name(name);
+}
+
+/* number of events at or before 'time' */
+int event_upper_bound(const struct divecomputer *dc, int time)
+{
+	int lo = 0, hi = dc->nr_events;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (dc->events[mid].time.seconds <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int event_lower_bound(const struct divecomputer *dc, int time)
+{
+	return event_upper_bound(dc, time - 1);
+}
+
+/* set up the list links of the events from index 'from' on */
+static void link_events(struct divecomputer *dc, int from)
+{
+	int i, nr = dc->nr_events;
+
+	if (from < 0)
+		from = 0;
+	for (i = from; i < nr - 1; i++)
+		dc->events[i].next = dc->events + i + 1;
+	if (nr)
+		dc->events[nr - 1].next = NULL;
+}
+
+static bool grow_events(struct divecomputer *dc, int nr)
+{
+	struct event *events;
+	int alloc;
+
+	if (nr <= dc->alloc_events)
+		return true;
+	alloc = nr * 3 / 2 + 4;
+	events = dive_arena_realloc(dc->events, dc->nr_events * sizeof(struct event), alloc * sizeof(struct event));
+	if (!events)
+		return false;
+	dc->events = events;
+	dc->alloc_events = alloc;
+	link_events(dc, 0);
+	return true;
+}
+
+void clear_dc_events(struct divecomputer *dc)
+{
+	dive_arena_free(dc->events);
+	dc->events = NULL;
+	dc->nr_events = dc->alloc_events = 0;
+}
+
+static void delete_event(struct divecomputer *dc, int idx)
+{
+	struct event *ev = dc->events + idx;
+
+	if (dc->nr_events == 1) {
+		clear_dc_events(dc);
+		return;
+	}
+	memmove(ev, ev + 1, (dc->nr_events - idx - 1) * sizeof(*ev));
+	dc->nr_events--;
+	link_events(dc, idx - 1);
+}
+
 void add_event(struct divecomputer *dc, int time, int type, int flags, int value, const char *name)
 {
-	struct event *ev, **p;
-	unsigned int size, len = strlen(name);
+	struct event *ev;
+	int idx;
 
-	size = sizeof(*ev) + len + 1;
-	ev = malloc(size);
-	if (!ev)
+	if (!grow_events(dc, dc->nr_events + 1))
 		return;
-	memset(ev, 0, size);
-	memcpy(ev->name, name, len);
+
+	/* insert in the sorted array of events, after the ones at the same time */
+	idx = event_upper_bound(dc, time);
+	ev = dc->events + idx;
+	memmove(ev + 1, ev, (dc->nr_events - idx) * sizeof(*ev));
+	memset(ev, 0, sizeof(*ev));
 	ev->time.seconds = time;
 	ev->type = type;
 	ev->flags = flags;
 	ev->value = value;
-
-	p = &dc->events;
-
-	/* insert in the sorted list of events */
-	while (*p && (*p)->time.seconds <= time)
-		p = &(*p)->next;
-	ev->next = *p;
-	*p = ev;
+	ev->name_id = event_name_id(name);
+	ev->name = event_names.names[ev->name_id];
+	dc->nr_events++;
+	link_events(dc, idx - 1);
 	remember_event(name);
 }
 
@@ -62,59 +212,65 @@ static int same_event(struct event *a, struct event *b)
 		return 0;
 	if (a->value != b->value)
 		return 0;
-	return !strcmp(a->name, b->name);
+	return a->name_id == b->name_id;
+}
+
+/* find the event of the dive computer that is the same as 'event';
+ * it may be a copy from another dive */
+static int find_event(struct divecomputer *dc, struct event *event)
+{
+	int i;
+
+	for (i = event_lower_bound(dc, event->time.seconds); i < dc->nr_events; i++) {
+		if (dc->events[i].time.seconds != event->time.seconds)
+			break;
+		if (same_event(dc->events + i, event))
+			return i;
+	}
+	return -1;
 }
 
 void remove_event(struct event* event)
 {
-	struct event **ep = &current_dc->events;
-	while (ep && !same_event(*ep, event))
-		ep = &(*ep)->next;
-	if (ep) {
-		/* we can't link directly with event->next
-		 * because 'event' can be a copy from another
-		 * dive (for instance the displayed_dive
-		 * that we use on the interface to show things). */
-		struct event *temp = (*ep)->next;
-		free(*ep);
-		*ep = temp;
+	/* we can't just use the event itself because 'event'
+	 * can be a copy from another dive (for instance the
+	 * displayed_dive that we use on the interface to show things). */
+	int idx = find_event(current_dc, event);
+
+	if (idx >= 0) {
+		delete_event(current_dc, idx);
+		invalidate_oxygen_exposure(selected_dive);
 	}
 }
 
-/* since the name is an array as part of the structure (how silly is that?) we
- * have to actually remove the existing event and replace it with a new one.
- * WARNING, WARNING... this may end up freeing event in case that event is indeed
- * WARNING, WARNING... part of this divecomputer on this dive! */
+/* The name is interned, so we simply switch the event over to the new one.
+ * The event can be a copy from another dive just like for remove_event() */
 void update_event_name(struct dive *d, struct event* event, char *name)
 {
+	int idx;
+
 	if (!d || !event)
 		return;
 	struct divecomputer *dc = get_dive_dc(d, dc_number);
 	if (!dc)
 		return;
-	struct event **removep = &dc->events;
-	struct event *remove;
-	while ((*removep)->next && !same_event(*removep, event))
-		removep = &(*removep)->next;
-	if (!same_event(*removep, event))
+	idx = find_event(dc, event);
+	if (idx < 0)
 		return;
-	remove = *removep;
-	*removep = (*removep)->next;
-	add_event(dc, event->time.seconds, event->type, event->flags, event->value, name);
-	free(remove);
+	dc->events[idx].name_id = event_name_id(name);
+	dc->events[idx].name = event_names.names[dc->events[idx].name_id];
+	remember_event(name);
 }
 
-/* this returns a pointer to static variable - so use it right away after calling */
-struct gasmix *get_gasmix_from_event(struct event *ev)
+/* no static buffer here, the statistics call this from several threads */
+void get_gasmix_from_event(struct event *ev, struct gasmix *g)
 {
-	static struct gasmix g;
-	g.o2.permille = g.he.permille = 0;
+	g->o2.permille = g->he.permille = 0;
 	if (ev && (ev->type == SAMPLE_EVENT_GASCHANGE || ev->type == SAMPLE_EVENT_GASCHANGE2)) {
-		g.o2.permille = 10 * ev->value & 0xffff;
+		g->o2.permille = 10 * ev->value & 0xffff;
 		if (ev->type == SAMPLE_EVENT_GASCHANGE2)
-			g.he.permille = 10 * (ev->value >> 16);
+			g->he.permille = 10 * (ev->value >> 16);
 	}
-	return &g;
 }
 
 int get_pressure_units(int mb, const char **units)
@@ -286,15 +442,14 @@ double get_weight_units(unsigned int grams, int *frac, const char **units)
 
 bool has_hr_data(struct divecomputer *dc)
 {
-	int i;
-	struct sample *sample;
+	struct sample_iter it;
+	const struct sample *sample;
 
 	if (!dc)
 		return false;
 
-	sample = dc->sample;
-	for (i = 0; i < dc->samples; i++)
-		if (sample[i].heartbeat)
+	for_each_sample(it, dc, sample)
+		if (sample->heartbeat)
 			return true;
 	return false;
 }
@@ -311,17 +466,190 @@ struct dive *alloc_dive(void)
 	return dive;
 }
 
+/*
+ * The arena of a dive.
+ *
+ * copy_dive() puts the samples, events, additional dive computers,
+ * pictures and tag entries of the copy into a single allocation, so
+ * making the copy is one malloc plus a few memcpy's and throwing it
+ * away again is one free. Everything else treats these objects just
+ * like malloc'ed ones, except that freeing or reallocating one of them
+ * has to go through dive_arena_free() / dive_arena_realloc(), which
+ * know not to hand arena memory back to malloc. Objects that get added
+ * to the dive later are malloc'ed as usual.
+ */
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct dive_arena {
+	struct dive_arena *next;	/* list of all live arenas */
+	char *pos, *end;
+	char data[];
+};
+
+static struct dive_arena *dive_arenas;
+
+static bool in_arena(const struct dive_arena *arena, const void *p)
+{
+	return (const char *)p >= arena->data && (const char *)p < arena->end;
+}
+
+/* only the copy_dive() copies (displayed_dive, really) own an arena, dives
+ * that go into the dive table through clone_dive() give theirs up, so this
+ * list stays short */
+static bool in_dive_arena(const void *p)
+{
+	const struct dive_arena *arena;
+
+	for (arena = dive_arenas; arena; arena = arena->next)
+		if (in_arena(arena, p))
+			return true;
+	return false;
+}
+
+void dive_arena_free(void *p)
+{
+	if (p && !in_dive_arena(p))
+		free(p);
+}
+
+void *dive_arena_realloc(void *p, size_t old_size, size_t size)
+{
+	void *n;
+
+	if (!p || !in_dive_arena(p))
+		return realloc(p, size);
+	n = malloc(size);
+	if (n)
+		memcpy(n, p, old_size < size ? old_size : size);
+	return n;
+}
+
+static struct dive_arena *new_dive_arena(size_t size)
+{
+	struct dive_arena *arena = malloc(sizeof(*arena) + size);
+
+	if (!arena)
+		exit(1);
+	arena->pos = arena->data;
+	arena->end = arena->data + size;
+	arena->next = dive_arenas;
+	dive_arenas = arena;
+	return arena;
+}
+
+static void free_dive_arena(struct dive_arena *arena)
+{
+	struct dive_arena **p = &dive_arenas;
+
+	if (!arena)
+		return;
+	while (*p != arena)
+		p = &(*p)->next;
+	*p = arena->next;
+	free(arena);
+}
+
+static void *arena_alloc(struct dive_arena *arena, size_t size)
+{
+	void *p = arena->pos;
+
+	arena->pos += ARENA_ALIGN(size);
+	return p;
+}
+
+/* how much room do the copies of everything a dive owns take? */
+static size_t dive_arena_size(struct dive *d)
+{
+	size_t size = 0;
+	struct divecomputer *dc;
+	struct tag_entry *tag;
+
+	for_each_dc(d, dc) {
+		if (dc != &d->dc)
+			size += ARENA_ALIGN(sizeof(*dc));
+		size += ARENA_ALIGN(dc->samples * sizeof(struct sample));
+		size += ARENA_ALIGN(dc->nr_events * sizeof(struct event));
+	}
+	FOR_EACH_PICTURE(d)
+		size += ARENA_ALIGN(sizeof(*picture));
+	for (tag = d->tag_list; tag; tag = tag->next)
+		size += ARENA_ALIGN(sizeof(*tag));
+	return size;
+}
+
+static void *unshare(struct dive_arena *arena, void *p, size_t size)
+{
+	void *copy;
+
+	if (!in_arena(arena, p))
+		return p;
+	copy = malloc(size);
+	if (!copy)
+		exit(1);
+	memcpy(copy, p, size);
+	return copy;
+}
+
+/* give the dive malloc'ed copies of everything in its arena, so that
+ * parts of it can be handed over to a different dive */
+static void unshare_dive(struct dive *d)
+{
+	struct dive_arena *arena = d->arena;
+	struct divecomputer **dcp, *dc;
+	struct picture **picp;
+	struct tag_entry **tagp;
+
+	if (!arena)
+		return;
+	for (dcp = &d->dc.next; *dcp; dcp = &(*dcp)->next)
+		*dcp = unshare(arena, *dcp, sizeof(**dcp));
+	for_each_dc(d, dc) {
+		dc->sample = unshare(arena, dc->sample, dc->alloc_samples * sizeof(struct sample));
+		dc->events = unshare(arena, dc->events, dc->alloc_events * sizeof(struct event));
+		link_events(dc, 0);
+	}
+	for (picp = &d->picture_list; *picp; picp = &(*picp)->next)
+		*picp = unshare(arena, *picp, sizeof(**picp));
+	for (tagp = &d->tag_list; *tagp; tagp = &(*tagp)->next)
+		*tagp = unshare(arena, *tagp, sizeof(**tagp));
+	d->arena = NULL;
+	free_dive_arena(arena);
+}
+
 static void free_dc(struct divecomputer *dc);
 static void free_pic(struct picture *picture);
 
 /* this is very different from the copy_divecomputer later in this file;
- * this function actually makes full copies of the content */
+ * this function copies the dive computer itself, copy_dc_data() then
+ * copies the samples and events into the arena */
 static void copy_dc(struct divecomputer *sdc, struct divecomputer *ddc)
 {
 	*ddc = *sdc;
 	ddc->model = copy_string(sdc->model);
-	copy_samples(sdc, ddc);
-	copy_events(sdc, ddc);
+}
+
+static void copy_dc_data(struct dive_arena *arena, struct divecomputer *sdc, struct divecomputer *ddc)
+{
+	int nr = sdc->samples;
+
+	ddc->samples = ddc->alloc_samples = nr;
+	ddc->sample = NULL;
+	ddc->packed = NULL;
+	if (nr) {
+		/* the copy always gets a plain array, it's usually about to be edited */
+		ddc->sample = arena_alloc(arena, nr * sizeof(struct sample));
+		if (sdc->packed)
+			unpack_samples(sdc->packed, ddc->sample);
+		else
+			memcpy(ddc->sample, sdc->sample, nr * sizeof(struct sample));
+	}
+	ddc->nr_events = ddc->alloc_events = sdc->nr_events;
+	ddc->events = NULL;
+	if (sdc->nr_events) {
+		ddc->events = arena_alloc(arena, sdc->nr_events * sizeof(struct event));
+		memcpy(ddc->events, sdc->events, sdc->nr_events * sizeof(struct event));
+		link_events(ddc, 0);
+	}
 }
 
 /* copy an element in a list of pictures */
@@ -331,12 +659,10 @@ static void copy_pl(struct picture *sp, struct picture *dp)
 	dp->filename = copy_string(sp->filename);
 }
 
-/* copy an element in a list of tags */
+/* copy an element in a list of tags; the divetags themselves are shared */
 static void copy_tl(struct tag_entry *st, struct tag_entry *dt)
 {
-	dt->tag = malloc(sizeof(struct divetag));
-	dt->tag->name = copy_string(st->tag->name);
-	dt->tag->source = copy_string(st->tag->source);
+	dt->tag = st->tag;
 }
 
 /* Clear everything but the first element;
@@ -361,6 +687,18 @@ static void copy_tl(struct tag_entry *st, struct tag_entry *dt)
 	*_dptr = 0;                                 \
 	}
 
+#define ARENA_LIST_COPY(_arena, _type, _first, _dest, _cpy) {\
+	_type *_sptr = _first;                      \
+	_type **_dptr = &_dest;                     \
+	while(_sptr) {                              \
+		*_dptr = arena_alloc(_arena, sizeof(_type)); \
+		_cpy(_sptr, *_dptr);                 \
+		_sptr = _sptr->next;                \
+		_dptr = &(*_dptr)->next;            \
+	}                                           \
+	*_dptr = 0;                                 \
+	}
+
 /* copy_dive makes duplicates of many components of a dive;
  * in order not to leak memory, we need to free those .
  * copy_dive doesn't play with the divetrip and forward/backward pointers
@@ -370,40 +708,57 @@ void clear_dive(struct dive *d)
 	if (!d)
 		return;
 	/* free the strings */
-	free(d->buddy);
-	free(d->divemaster);
-	free(d->location);
-	free(d->notes);
-	free(d->suit);
-	/* free tags, additional dive computers, and pictures */
+	release_string(d->buddy);
+	release_string(d->divemaster);
+	release_string(d->location);
+	release_string(d->notes);
+	release_string(d->suit);
+	/* free tags, samples and events, additional dive computers, and pictures;
+	 * whatever came from the arena goes away with the arena */
 	taglist_free(d->tag_list);
+	dive_arena_free(d->dc.sample);
+	free(d->dc.packed);
+	dive_arena_free(d->dc.events);
 	STRUCTURED_LIST_FREE(struct divecomputer, d->dc.next, free_dc);
 	STRUCTURED_LIST_FREE(struct picture, d->picture_list, free_pic);
+	free_dive_arena(d->arena);
 	memset(d, 0, sizeof(struct dive));
 }
 
+/* free a dive that is no longer in the dive table with everything it owns */
+void free_dive(struct dive *d)
+{
+	clear_dive(d);
+	free(d);
+}
+
 /* make a true copy that is independent of the source dive;
  * all data structures are duplicated, so the copy can be modified without
  * any impact on the source */
 void copy_dive(struct dive *s, struct dive *d)
 {
+	struct dive_arena *arena;
+	struct divecomputer *sdc, *ddc;
+
 	clear_dive(d);
 	/* simply copy things over, but then make actual copies of the
 	 * relevant components that are referenced through pointers,
-	 * so all the strings and the structured lists */
+	 * so all the strings and the structured lists; all of the
+	 * latter go into the arena of the copy */
 	*d = *s;
-	d->buddy = copy_string(s->buddy);
-	d->divemaster = copy_string(s->divemaster);
-	d->location = copy_string(s->location);
+	d->arena = arena = new_dive_arena(dive_arena_size(s));
+	d->buddy = intern_string(s->buddy);
+	d->divemaster = intern_string(s->divemaster);
+	d->location = intern_string(s->location);
 	d->notes = copy_string(s->notes);
-	d->suit = copy_string(s->suit);
-	STRUCTURED_LIST_COPY(struct picture, s->picture_list, d->picture_list, copy_pl);
-	STRUCTURED_LIST_COPY(struct tag_entry, s->tag_list, d->tag_list, copy_tl);
-	STRUCTURED_LIST_COPY(struct divecomputer, s->dc.next, d->dc.next, copy_dc);
-	/* this only copied dive computers 2 and up. The first dive computer is part
-	 * of the struct dive, so let's make copies of its samples and events */
-	copy_samples(&s->dc, &d->dc);
-	copy_events(&s->dc, &d->dc);
+	d->suit = intern_string(s->suit);
+	ARENA_LIST_COPY(arena, struct picture, s->picture_list, d->picture_list, copy_pl);
+	ARENA_LIST_COPY(arena, struct tag_entry, s->tag_list, d->tag_list, copy_tl);
+	ARENA_LIST_COPY(arena, struct divecomputer, s->dc.next, d->dc.next, copy_dc);
+	/* the first dive computer is part of the struct dive, the others
+	 * were just copied; now copy the samples and events of all of them */
+	for (sdc = &s->dc, ddc = &d->dc; sdc; sdc = sdc->next, ddc = ddc->next)
+		copy_dc_data(arena, sdc, ddc);
 }
 
 /* make a clone of the source dive and clean out the source dive;
@@ -415,6 +770,8 @@ struct dive *clone_dive(struct dive *s)
 	struct dive *dive = alloc_dive();
 	*dive = *s; // so all the pointers in dive point to the things s pointed to
 	memset(s, 0, sizeof(struct dive)); // and now the pointers in s are gone
+	// the clone is going to stay around, so it shouldn't keep an arena alive
+	unshare_dive(dive);
 	return dive;
 }
 
@@ -422,16 +779,20 @@ struct dive *clone_dive(struct dive *s)
 	if (what._component)                \
 		d->_component = copy_string(s->_component)
 
+#define CONDITIONAL_INTERN_STRING(_component) \
+	if (what._component)                  \
+		d->_component = intern_string(s->_component)
+
 // copy elements, depending on bits in what that are set
 void selective_copy_dive(struct dive *s, struct dive *d, struct dive_components what, bool clear)
 {
 	if (clear)
 		clear_dive(d);
-	CONDITIONAL_COPY_STRING(location);
+	CONDITIONAL_INTERN_STRING(location);
 	CONDITIONAL_COPY_STRING(notes);
-	CONDITIONAL_COPY_STRING(divemaster);
-	CONDITIONAL_COPY_STRING(buddy);
-	CONDITIONAL_COPY_STRING(suit);
+	CONDITIONAL_INTERN_STRING(divemaster);
+	CONDITIONAL_INTERN_STRING(buddy);
+	CONDITIONAL_INTERN_STRING(suit);
 	if (what.rating)
 		d->rating = s->rating;
 	if (what.visibility)
@@ -453,15 +814,17 @@ void selective_copy_dive(struct dive *s, struct dive *d, struct dive_components
 /* only copies events from the first dive computer */
 void copy_events(struct divecomputer *s, struct divecomputer *d)
 {
-	struct event *ev;
 	if (!s || !d)
 		return;
-	ev = s->events;
+	d->nr_events = d->alloc_events = s->nr_events;
 	d->events = NULL;
-	while (ev != NULL) {
-		add_event(d, ev->time.seconds, ev->type, ev->flags, ev->value, ev->name);
-		ev = ev->next;
-	}
+	if (!s->nr_events)
+		return;
+	d->events = malloc(s->nr_events * sizeof(struct event));
+	if (!d->events)
+		exit(1);
+	memcpy(d->events, s->events, s->nr_events * sizeof(struct event));
+	link_events(d, 0);
 }
 
 int nr_cylinders(struct dive *dive)
@@ -513,22 +876,33 @@ void copy_samples(struct divecomputer *s, struct divecomputer *d)
 		return;
 	int nr = s->samples;
 	d->samples = nr;
+	d->alloc_samples = nr;
+	d->packed = NULL;
 	d->sample = malloc(nr * sizeof(struct sample));
-	if (d->sample)
+	if (!d->sample)
+		return;
+	/* the copy always gets a plain array, it's usually about to be edited */
+	if (s->packed)
+		unpack_samples(s->packed, d->sample);
+	else
 		memcpy(d->sample, s->sample, nr * sizeof(struct sample));
 }
 
 struct sample *prepare_sample(struct divecomputer *dc)
 {
 	if (dc) {
-		int nr = dc->samples;
-		int alloc_samples = dc->alloc_samples;
+		int nr, alloc_samples;
 		struct sample *sample;
+
+		/* adding samples needs the plain array */
+		unpack_dc_samples(dc);
+		nr = dc->samples;
+		alloc_samples = dc->alloc_samples;
 		if (nr >= alloc_samples) {
 			struct sample *newsamples;
 
 			alloc_samples = (alloc_samples * 3) / 2 + 10;
-			newsamples = realloc(dc->sample, alloc_samples * sizeof(struct sample));
+			newsamples = dive_arena_realloc(dc->sample, nr * sizeof(struct sample), alloc_samples * sizeof(struct sample));
 			if (!newsamples)
 				return NULL;
 			dc->alloc_samples = alloc_samples;
@@ -855,29 +1229,13 @@ static void sanitize_cylinder_info(struct dive *dive)
 /* some events should never be thrown away */
 static bool is_potentially_redundant(struct event *event)
 {
-	if (!strcmp(event->name, "gaschange"))
-		return false;
-	if (!strcmp(event->name, "bookmark"))
+	switch (event->name_id) {
+	case EVENT_NAME_GASCHANGE:
+	case EVENT_NAME_BOOKMARK:
+	case EVENT_NAME_HEADING:
 		return false;
-	if (!strcmp(event->name, "heading"))
-		return false;
-	return true;
-}
-
-/* match just by name - we compare the details in the code that uses this helper */
-static struct event *find_previous_event(struct divecomputer *dc, struct event *event)
-{
-	struct event *ev = dc->events;
-	struct event *previous = NULL;
-
-	if (!event->name)
-		return NULL;
-	while (ev && ev != event) {
-		if (ev->name && !strcmp(ev->name, event->name))
-			previous = ev;
-		ev = ev->next;
 	}
-	return previous;
+	return true;
 }
 
 static void fixup_surface_pressure(struct dive *dive)
@@ -994,7 +1352,7 @@ static void un_fixup_airtemp(struct dive *a)
 }
 
 /*
- * events are stored as a linked list, so the concept of
+ * events of all kinds are stored in one array, so the concept of
  * "consecutive, identical events" is somewhat hard to
  * implement correctly (especially given that on some dive
  * computers events are asynchronous, so they can come in
@@ -1007,34 +1365,39 @@ static void un_fixup_airtemp(struct dive *a)
  * profile with)
  *
  * We first only mark the events for deletion so that we
- * still know when the previous event happened.
+ * still know when the previous event happened. The previous
+ * event of the same name is tracked per name id as we go.
  */
 static void fixup_dc_events(struct divecomputer *dc)
 {
-	struct event *event;
+	struct event *events = dc->events;
+	int i, j, *previous;
 
-	event = dc->events;
-	while (event) {
-		struct event *prev;
-		if (is_potentially_redundant(event)) {
-			prev = find_previous_event(dc, event);
-			if (prev && prev->value == event->value &&
+	if (!dc->nr_events)
+		return;
+	previous = malloc(event_names.nr * sizeof(int));
+	if (!previous)
+		exit(1);
+	for (i = 0; i < event_names.nr; i++)
+		previous[i] = -1;
+	for (i = 0; i < dc->nr_events; i++) {
+		struct event *event = events + i;
+		if (is_potentially_redundant(event) && previous[event->name_id] >= 0) {
+			struct event *prev = events + previous[event->name_id];
+			if (prev->value == event->value &&
 			    prev->flags == event->flags &&
 			    event->time.seconds - prev->time.seconds < 61)
 				event->deleted = true;
 		}
-		event = event->next;
-	}
-	event = dc->events;
-	while (event) {
-		if (event->next && event->next->deleted) {
-			struct event *nextnext = event->next->next;
-			free(event->next);
-			event->next = nextnext;
-		} else {
-			event = event->next;
-		}
+		previous[event->name_id] = i;
 	}
+	free(previous);
+	for (i = j = 0; i < dc->nr_events; i++) {
+		if (!events[i].deleted)
+			events[j++] = events[i];
+	}
+	dc->nr_events = j;
+	link_events(dc, 0);
 }
 
 static void fixup_dive_dc(struct dive *dive, struct divecomputer *dc)
@@ -1049,6 +1412,9 @@ static void fixup_dive_dc(struct dive *dive, struct divecomputer *dc)
 	int lasttemp = 0, lastpressure = 0;
 	int pressure_delta[MAX_CYLINDERS] = { INT_MAX, };
 
+	/* this fixes up samples in place */
+	unpack_dc_samples(dc);
+
 	/* Fixup duration and mean depth */
 	fixup_dc_duration(dc);
 
@@ -1360,8 +1726,8 @@ static int sort_event(struct event *a, struct event *b)
 
 static void merge_events(struct divecomputer *res, struct divecomputer *src1, struct divecomputer *src2, int offset)
 {
-	struct event *a, *b;
-	struct event **p = &res->events;
+	struct event *a, *b, *events;
+	int i = 0, j = 0, nr = 0;
 
 	/* Always use positive offsets */
 	if (offset < 0) {
@@ -1375,38 +1741,45 @@ static void merge_events(struct divecomputer *res, struct divecomputer *src1, st
 
 	a = src1->events;
 	b = src2->events;
-	while (b) {
-		b->time.seconds += offset;
-		b = b->next;
-	}
-	b = src2->events;
+	for (j = 0; j < src2->nr_events; j++)
+		b[j].time.seconds += offset;
+	j = 0;
 
-	while (a || b) {
+	events = malloc((src1->nr_events + src2->nr_events) * sizeof(struct event));
+	if (!events)
+		exit(1);
+	while (i < src1->nr_events || j < src2->nr_events) {
 		int s;
-		if (!b) {
-			*p = a;
-			break;
+		if (j == src2->nr_events) {
+			events[nr++] = a[i++];
+			continue;
 		}
-		if (!a) {
-			*p = b;
-			break;
+		if (i == src1->nr_events) {
+			events[nr++] = b[j++];
+			continue;
 		}
-		s = sort_event(a, b);
+		s = sort_event(a + i, b + j);
 		/* Pick b */
 		if (s > 0) {
-			*p = b;
-			p = &b->next;
-			b = b->next;
+			events[nr++] = b[j++];
 			continue;
 		}
 		/* Pick 'a' or neither */
-		if (s < 0) {
-			*p = a;
-			p = &a->next;
-		}
-		a = a->next;
-		continue;
+		if (s < 0)
+			events[nr++] = a[i];
+		i++;
 	}
+	clear_dc_events(src1);
+	clear_dc_events(src2);
+	clear_dc_events(res);
+	if (!nr) {
+		free(events);
+		return;
+	}
+	res->events = events;
+	res->nr_events = nr;
+	res->alloc_events = i + j;
+	link_events(res, 0);
 }
 
 /* Pick whichever has any info (if either). Prefer 'a' */
@@ -2004,28 +2377,20 @@ struct dive *try_to_merge(struct dive *a, struct dive *b, bool prefer_downloaded
 	return NULL;
 }
 
-static void free_events(struct event *ev)
-{
-	while (ev) {
-		struct event *next = ev->next;
-		free(ev);
-		ev = next;
-	}
-}
-
 static void free_dc(struct divecomputer *dc)
 {
-	free(dc->sample);
+	dive_arena_free(dc->sample);
+	free(dc->packed);
 	free((void *)dc->model);
-	free_events(dc->events);
-	free(dc);
+	dive_arena_free(dc->events);
+	dive_arena_free(dc);
 }
 
 static void free_pic(struct picture *picture)
 {
 	if (picture) {
 		free(picture->filename);
-		free(picture);
+		dive_arena_free(picture);
 	}
 }
 
@@ -2134,6 +2499,8 @@ static void copy_dive_computer(struct divecomputer *res, struct divecomputer *a)
 	res->model = copy_string(a->model);
 	res->samples = res->alloc_samples = 0;
 	res->sample = NULL;
+	res->packed = NULL;
+	res->nr_events = res->alloc_events = 0;
 	res->events = NULL;
 	res->next = NULL;
 }
@@ -2165,9 +2532,12 @@ static void interleave_dive_computers(struct divecomputer *res,
 			res->sample = a->sample;
 			res->samples = a->samples;
 			res->events = a->events;
+			res->nr_events = a->nr_events;
+			res->alloc_events = a->alloc_events;
 			a->sample = NULL;
 			a->samples = 0;
 			a->events = NULL;
+			a->nr_events = a->alloc_events = 0;
 		}
 		a = a->next;
 		if (!a)
@@ -2304,10 +2674,98 @@ static struct divetag *taglist_add_divetag(struct tag_entry **tag_list, struct d
 	return tag;
 }
 
-struct divetag *taglist_add_tag(struct tag_entry **tag_list, const char *tag)
+/*
+ * Registry of all divetags. g_tag_list keeps them sorted by name, the
+ * hash finds them by name (and the default tags also by their untranslated
+ * source) and tags[] maps the tag ids back to the tags.
+ */
+struct tag_hash_entry {
+	const char *key;
+	struct divetag *tag;
+};
+
+static struct {
+	int nr, allocated;
+	struct divetag **tags;
+	unsigned int size, used;
+	struct tag_hash_entry *hash;
+} tag_registry;
+
+static unsigned int tag_hash(const char *s)
+{
+	/* FNV-1a */
+	unsigned int h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static struct tag_hash_entry *tag_hash_slot(const char *key)
+{
+	unsigned int mask = tag_registry.size - 1;
+	unsigned int i = tag_hash(key) & mask;
+
+	while (tag_registry.hash[i].key && strcmp(tag_registry.hash[i].key, key))
+		i = (i + 1) & mask;
+	return tag_registry.hash + i;
+}
+
+static struct divetag *lookup_divetag(const char *name)
+{
+	if (!tag_registry.size)
+		return NULL;
+	return tag_hash_slot(name)->tag;
+}
+
+static void tag_hash_insert(const char *key, struct divetag *tag)
+{
+	struct tag_hash_entry *entry;
+
+	if (2 * (tag_registry.used + 1) > tag_registry.size) {
+		unsigned int i, size = tag_registry.size;
+		struct tag_hash_entry *old = tag_registry.hash;
+
+		tag_registry.size = size ? 2 * size : 64;
+		tag_registry.hash = calloc(tag_registry.size, sizeof(struct tag_hash_entry));
+		if (!tag_registry.hash)
+			exit(1);
+		for (i = 0; i < size; i++)
+			if (old[i].key)
+				*tag_hash_slot(old[i].key) = old[i];
+		free(old);
+	}
+	entry = tag_hash_slot(key);
+	if (entry->key)
+		return;
+	entry->key = key;
+	entry->tag = tag;
+	tag_registry.used++;
+}
+
+static void register_divetag(struct divetag *tag)
+{
+	if (tag_registry.nr >= tag_registry.allocated) {
+		int allocated = (tag_registry.nr + 16) * 3 / 2;
+		struct divetag **tags = realloc(tag_registry.tags, allocated * sizeof(struct divetag *));
+		if (!tags)
+			exit(1);
+		tag_registry.tags = tags;
+		tag_registry.allocated = allocated;
+	}
+	tag_registry.tags[tag_registry.nr++] = tag;
+	tag->id = tag_registry.nr;
+	tag_hash_insert(tag->name, tag);
+	if (tag->source)
+		tag_hash_insert(tag->source, tag);
+	taglist_add_divetag(&g_tag_list, tag);
+	invalidate_tag_bitmaps();
+}
+
+static struct divetag *new_divetag(const char *tag)
 {
 	int i = 0, is_default_tag = 0;
-	struct divetag *ret_tag, *new_tag;
+	struct divetag *new_tag;
 	const char *translation;
 	new_tag = malloc(sizeof(struct divetag));
 
@@ -2329,24 +2787,83 @@ struct divetag *taglist_add_tag(struct tag_entry **tag_list, const char *tag)
 		new_tag->name = malloc(strlen(tag) + 1);
 		memcpy(new_tag->name, tag, strlen(tag) + 1);
 	}
-	/* Try to insert new_tag into g_tag_list if we are not operating on it */
-	if (tag_list != &g_tag_list) {
-		ret_tag = taglist_add_divetag(&g_tag_list, new_tag);
-		/* g_tag_list already contains new_tag, free the duplicate */
-		if (ret_tag != new_tag)
-			taglist_free_divetag(new_tag);
-		ret_tag = taglist_add_divetag(tag_list, ret_tag);
-	} else {
-		ret_tag = taglist_add_divetag(tag_list, new_tag);
-		if (ret_tag != new_tag)
+	new_tag->id = 0;
+	return new_tag;
+}
+
+struct divetag *taglist_add_tag(struct tag_entry **tag_list, const char *tag)
+{
+	struct divetag *ret_tag, *new_tag;
+
+	/* Known tags (by name or by untranslated default name) are a single lookup */
+	ret_tag = lookup_divetag(tag);
+	if (!ret_tag) {
+		new_tag = new_divetag(tag);
+		ret_tag = lookup_divetag(new_tag->name);
+		/* we already have a tag with that (translated) name, free the duplicate */
+		if (ret_tag) {
 			taglist_free_divetag(new_tag);
+		} else {
+			register_divetag(new_tag);
+			ret_tag = new_tag;
+		}
 	}
+	if (tag_list != &g_tag_list)
+		taglist_add_divetag(tag_list, ret_tag);
 	return ret_tag;
 }
 
+static struct {
+	bool valid;
+	int nr_tags, words;
+	uint32_t *bits;
+} tag_bitmaps;
+
+void invalidate_tag_bitmaps(void)
+{
+	tag_bitmaps.valid = false;
+}
+
+static void build_tag_bitmaps(void)
+{
+	int i;
+	struct dive *dive;
+	struct tag_entry *entry;
+	int words = DIVE_BITMAP_WORDS(dive_table.nr);
+
+	free(tag_bitmaps.bits);
+	tag_bitmaps.bits = calloc((tag_registry.nr + 1) * words + 1, sizeof(uint32_t));
+	if (!tag_bitmaps.bits)
+		exit(1);
+	tag_bitmaps.nr_tags = tag_registry.nr;
+	tag_bitmaps.words = words;
+	for_each_dive (i, dive) {
+		uint32_t bit = 1u << (i & 31);
+
+		if (!dive->tag_list)
+			tag_bitmaps.bits[i / 32] |= bit;
+		for (entry = dive->tag_list; entry; entry = entry->next) {
+			int id = entry->tag->id;
+			if (id > 0 && id <= tag_registry.nr)
+				tag_bitmaps.bits[id * words + i / 32] |= bit;
+		}
+	}
+	tag_bitmaps.valid = true;
+}
+
+const uint32_t *tag_dive_bitmap(int id)
+{
+	if (id < 0 || id > tag_registry.nr)
+		return NULL;
+	if (!tag_bitmaps.valid || tag_bitmaps.nr_tags != tag_registry.nr ||
+	    tag_bitmaps.words != DIVE_BITMAP_WORDS(dive_table.nr))
+		build_tag_bitmaps();
+	return tag_bitmaps.bits + id * tag_bitmaps.words;
+}
+
 void taglist_free(struct tag_entry *entry)
 {
-	STRUCTURED_LIST_FREE(struct tag_entry, entry, free)
+	STRUCTURED_LIST_FREE(struct tag_entry, entry, dive_arena_free)
 }
 
 /* Merge src1 and src2, write to *dst */
@@ -2372,6 +2889,16 @@ struct dive *merge_dives(struct dive *a, struct dive *b, int offset, bool prefer
 {
 	struct dive *res = alloc_dive();
 	struct dive *dl = NULL;
+	struct divecomputer *dc;
+
+	/* merging needs random access to the samples, and it hands
+	 * dive computers of a and b to res */
+	unshare_dive(a);
+	unshare_dive(b);
+	for_each_dc(a, dc)
+		unpack_dc_samples(dc);
+	for_each_dc(b, dc)
+		unpack_dc_samples(dc);
 
 	/* Aim for newly downloaded dives to be 'b' (keep old dive data first) */
 	if (a->downloaded && !b->downloaded) {
@@ -2464,6 +2991,8 @@ void shift_times(const timestamp_t amount)
 			continue;
 		dive->when += amount;
 	}
+	invalidate_oxygen_exposure(0);
+	invalidate_dive_summary(0);
 }
 
 timestamp_t get_times()
@@ -2589,7 +3118,7 @@ static void picture_free( struct picture *p){
 	if (!p)
 		return;
 	free( p->filename );
-	free( p );
+	dive_arena_free( p );
 }
 void dive_remove_picture(char *filename)
 {
@@ -2622,7 +3151,8 @@ void make_first_dc()
 	*newdc = current_dive->dc;
 	current_dive->dc = *cur_dc;
 	current_dive->dc.next = newdc;
-	free(cur_dc);
+	dive_arena_free(cur_dc);
+	invalidate_oxygen_exposure(selected_dive);
 }
 
 /* always acts on the current dive */
@@ -2646,11 +3176,12 @@ void delete_current_divecomputer(void)
 		/* remove the first one, so copy the second one in place of the first and free the second one
 		 * be careful about freeing the no longer needed structures - since we copy things around we can't use free_dc()*/
 		struct divecomputer *fdc = dc->next;
-		free(dc->sample);
+		dive_arena_free(dc->sample);
+		free(dc->packed);
 		free((void *)dc->model);
-		free_events(dc->events);
+		dive_arena_free(dc->events);
 		memcpy(dc, fdc, sizeof(struct divecomputer));
-		free(fdc);
+		dive_arena_free(fdc);
 	} else {
 		struct divecomputer *pdc = &current_dive->dc;
 		while (pdc->next != dc && pdc->next)
@@ -2662,4 +3193,5 @@ void delete_current_divecomputer(void)
 	}
 	if (dc_number == count_divecomputers())
 		dc_number--;
+	invalidate_oxygen_exposure(selected_dive);
 }
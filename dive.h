@@ -26,7 +26,7 @@
 
 static inline int same_string(const char *a, const char *b)
 {
-	return !strcmp(a ?: "", b ?: "");
+	return a == b || !strcmp(a ?: "", b ?: "");
 }
 
 static inline char *copy_string(const char *s)
@@ -81,15 +81,33 @@ typedef struct
 /*
  * Events are currently based straight on what libdivecomputer gives us.
  *  We need to wrap these into our own events at some point to remove some of the limitations.
+ *
+ * The events of a dive computer are kept in an array sorted by time.
+ * 'next' points to the following element of the array, so the events
+ * can still be walked like a list; it is only valid until the events
+ * of the dive computer are changed. The name is interned, events with
+ * the same name share both the string and the name_id.
  */
 struct event {
 	struct event *next;
 	duration_t time;
 	int type, flags, value;
+	int name_id;
 	bool deleted;
-	char name[];
+	const char *name;
+};
+
+/* the event names the core looks for have fixed ids */
+enum {
+	EVENT_NAME_NONE,
+	EVENT_NAME_GASCHANGE,
+	EVENT_NAME_BOOKMARK,
+	EVENT_NAME_HEADING
 };
 
+extern int event_name_id(const char *name);
+extern int find_event_name_id(const char *name);
+
 
 extern int get_pressure_units(int mb, const char **units);
 extern double get_depth_units(int mm, int *frac, const char **units);
@@ -122,7 +140,7 @@ struct gas_pressures {
 extern void fill_pressures(struct gas_pressures *pressures, const double amb_pressure, const struct gasmix *mix, double po2, const enum dive_comp_type type);
 extern void sanitize_gasmix(struct gasmix *mix);
 extern int gasmix_distance(const struct gasmix *a, const struct gasmix *b);
-extern struct gasmix *get_gasmix_from_event(struct event *ev);
+extern void get_gasmix_from_event(struct event *ev, struct gasmix *g);
 
 static inline bool gasmix_is_air(const struct gasmix *gasmix)
 {
@@ -172,6 +190,48 @@ struct sample                         // BASE TYPE BYTES  UNITS    RANGE      DE
 				       //                                     not calculated when planning a dive
 };                      // Total size of structure: 53 bytes, excluding padding at end
 
+/*
+ * The channels of a sample, as stored by the packed sample store
+ * (sample-store.c). Read samples through the iterator if they may be packed:
+ *
+ *	struct sample_iter it;
+ *	const struct sample *s;
+ *
+ *	for_each_sample(it, dc, s)
+ *		...
+ */
+enum sample_channel {
+	SC_TIME, SC_DEPTH, SC_STOPTIME, SC_NDL, SC_TTS, SC_STOPDEPTH,
+	SC_TEMPERATURE, SC_CYLINDERPRESSURE, SC_DILUENTPRESSURE, SC_PO2,
+	SC_O2SETPOINT, SC_O2SENSOR1, SC_O2SENSOR2, SC_O2SENSOR3, SC_BEARING,
+	SC_SENSOR, SC_CNS, SC_HEARTBEAT, SC_IN_DECO, SC_MANUALLY_ENTERED,
+	SAMPLE_CHANNELS
+};
+
+struct packed_samples;
+struct divecomputer;
+
+struct sample_iter {
+	const struct divecomputer *dc;
+	int i;
+	struct sample sample;
+	const unsigned char *pos[SAMPLE_CHANNELS];
+	int64_t prev[SAMPLE_CHANNELS];
+};
+
+extern struct packed_samples *pack_samples(const struct sample *sample, int nr);
+extern struct packed_samples *copy_packed_samples(const struct packed_samples *p);
+extern unsigned int packed_samples_size(const struct packed_samples *p);
+extern void unpack_samples(const struct packed_samples *p, struct sample *out);
+extern void pack_dc_samples(struct divecomputer *dc);
+extern void unpack_dc_samples(struct divecomputer *dc);
+extern void pack_dive_table(void);
+extern void sample_iter_init(struct sample_iter *it, const struct divecomputer *dc);
+extern const struct sample *sample_iter_next(struct sample_iter *it);
+
+#define for_each_sample(_it, _dc, _s) \
+	for (sample_iter_init(&(_it), (_dc)); ((_s) = sample_iter_next(&(_it))) != NULL;)
+
 struct divetag {
 	/*
 	 * The name of the divetag. If a translation is available, name contains
@@ -183,6 +243,11 @@ struct divetag {
 	 * This enables us to write a non-localized tag to the xml file.
 	 */
 	char *source;
+	/*
+	 * Small integer (starting at 1) identifying the tag, used to
+	 * index the per-tag dive bitmaps
+	 */
+	int id;
 };
 
 struct tag_entry {
@@ -212,6 +277,16 @@ void taglist_cleanup(struct tag_entry **tag_list);
 void taglist_init_global();
 void taglist_free(struct tag_entry *tag_list);
 
+/*
+ * Bitmaps with one bit per dive in dive_table, set for the dives that
+ * carry the tag with the given id; id 0 is the bitmap of the dives without
+ * any tags. They are built on demand and need to be invalidated when the
+ * dive table or the tags of the dives change.
+ */
+#define DIVE_BITMAP_WORDS(_nr) (((_nr) + 31) / 32)
+const uint32_t *tag_dive_bitmap(int id);
+void invalidate_tag_bitmaps(void);
+
 /*
  * NOTE! The deviceid and diveid are model-specific *hashes* of
  * whatever device identification that model may have. Different
@@ -238,7 +313,9 @@ struct divecomputer {
 	uint32_t deviceid, diveid;
 	int samples, alloc_samples;
 	struct sample *sample;
-	struct event *events;
+	struct packed_samples *packed;	// compact form of the samples, used when sample is NULL
+	int nr_events, alloc_events;
+	struct event *events;		// array of nr_events events sorted by time, or NULL
 	struct divecomputer *next;
 };
 
@@ -270,6 +347,7 @@ typedef struct dive_trip
 /* List of dive trips (sorted by date) */
 extern dive_trip_t *dive_trip_list;
 struct picture;
+struct dive_arena;
 struct dive {
 	int number;
 	tripflag_t tripflag;
@@ -300,6 +378,7 @@ struct dive {
 	struct divecomputer dc;
 	int id; // unique ID for this dive
 	struct picture *picture_list;
+	struct dive_arena *arena; // holds the samples, events etc of a copy_dive() copy
 };
 
 /* when selectively copying dive information, which parts should be copied? */
@@ -462,6 +541,34 @@ static inline struct dive *get_dive(int nr)
 	return dive_table.dives[nr];
 }
 
+/*
+ * The values the statistics and the globe need of every dive in the
+ * dive table, one array per value; row i belongs to dive_table.dives[i].
+ * Only valid until the dive table changes, so don't hold on to it.
+ */
+struct dive_summary {
+	int nr, allocated;
+	unsigned int generation;	/* changes whenever any row does */
+	timestamp_t *when;
+	int *year, *month;		/* of 'when', month is 1-12 */
+	int *duration;			/* seconds */
+	int *maxdepth, *meandepth;	/* mm */
+	int *sac;			/* ml/min */
+	int *mintemp, *maxtemp, *watertemp;	/* mkelvin */
+	int *rating;
+	int *latitude, *longitude;	/* udeg */
+	dive_trip_t **trip;
+};
+
+extern const struct dive_summary *get_dive_summary(void);
+extern void invalidate_dive_summary(int idx);
+extern void update_dive_summary(int idx);
+
+/* word index of the text fields and tags of the dives, for the search box */
+extern bool search_dive_text(const char *text, uint32_t *bitmap);
+extern void update_dive_text_index(struct dive *dive);
+extern void remove_dive_text_index(struct dive *dive);
+
 static inline unsigned int number_of_computers(struct dive *dive)
 {
 	unsigned int total_number = 0;
@@ -509,56 +616,18 @@ extern void delete_current_divecomputer(void);
 #define for_each_gps_location(_i, _x) \
 	for ((_i) = 0; ((_x) = get_gps_location(_i, &gps_location_table)) != NULL; (_i)++)
 
-static inline struct dive *get_dive_by_uemis_diveid(uint32_t diveid, uint32_t deviceid)
-{
-	int i;
-	struct dive *dive;
-
-	for_each_dive (i, dive) {
-		struct divecomputer *dc = &dive->dc;
-		do {
-			if (dc->diveid == diveid && dc->deviceid == deviceid)
-				return dive;
-		} while ((dc = dc->next) != NULL);
-	}
-	return NULL;
-}
-
-static inline struct dive *get_dive_by_uniq_id(int id)
-{
-	int i;
-	struct dive *dive = NULL;
-
-	for_each_dive (i, dive) {
-		if (dive->id == id)
-			break;
-	}
-#ifdef DEBUG
-	if (dive == NULL) {
-		fprintf(stderr, "Invalid id %x passed to get_dive_by_diveid, try to fix the code\n", id);
-		exit(1);
-	}
-#endif
-	return dive;
-}
-
-static inline int get_idx_by_uniq_id(int id)
-{
-	int i;
-	struct dive *dive = NULL;
-
-	for_each_dive (i, dive) {
-		if (dive->id == id)
-			break;
-	}
-#ifdef DEBUG
-	if (dive == NULL) {
-		fprintf(stderr, "Invalid id %x passed to get_dive_by_diveid, try to fix the code\n", id);
-		exit(1);
-	}
-#endif
-	return i;
-}
+extern struct dive *get_dive_by_uniq_id(int id);
+extern int get_idx_by_uniq_id(int id);
+extern int lookup_idx_by_uniq_id(int id);
+extern int next_merged_dive_id(void);
+extern void dive_id_index_add(int idx);
+extern void invalidate_dive_id_index(void);
+extern void build_dc_index(int nr);
+extern void dc_index_add(struct dive *dive);
+extern void free_dc_index(void);
+extern struct dive *dc_index_next_by_id(uint32_t deviceid, uint32_t diveid, int *pos);
+extern struct dive *dc_index_next_by_when(timestamp_t when, int *pos);
+extern struct dive *get_dive_by_uemis_diveid(uint32_t diveid, uint32_t deviceid);
 
 #ifdef __cplusplus
 extern "C" {
@@ -568,6 +637,7 @@ extern int report_error(const char *fmt, ...);
 extern const char *get_error_string(void);
 
 extern struct dive *find_dive_including(timestamp_t when);
+extern void invalidate_oxygen_exposure(int idx);
 extern bool dive_within_time_range(struct dive *dive, timestamp_t when, timestamp_t offset);
 struct dive *find_dive_n_near(timestamp_t when, int n, timestamp_t offset);
 
@@ -582,6 +652,20 @@ extern void set_filename(const char *filename, bool force);
 extern int parse_dm4_buffer(sqlite3 *handle, const char *url, const char *buf, int size, struct dive_table *table);
 extern int parse_shearwater_buffer(sqlite3 *handle, const char *url, const char *buf, int size, struct dive_table *table);
 
+enum csv_field {
+	CSV_TIME_FIELD,
+	CSV_DEPTH_FIELD,
+	CSV_TEMP_FIELD,
+	CSV_PO2_FIELD,
+	CSV_CNS_FIELD,
+	CSV_NDL_FIELD,
+	CSV_TTS_FIELD,
+	CSV_STOPDEPTH_FIELD,
+	CSV_PRESSURE_FIELD,
+	CSV_FIELDS
+};
+extern int parse_csv_buffer(const char *url, const char *buf, int size, const int *fields, int separator_index, int units, struct dive_table *table);
+
 extern int parse_file(const char *filename);
 extern int parse_csv_file(const char *filename, int time, int depth, int temp, int po2f, int cnsf, int ndlf, int ttsf, int stopdepthf, int pressuref, int sepidx, const char *csvtemplate, int units);
 extern int parse_manual_file(const char *filename, int separator_index, int units, int number, int date, int time, int duration, int location, int gps, int maxdepth, int meandepth, int buddy, int notes, int weight, int tags);
@@ -620,6 +704,9 @@ extern void shift_times(const timestamp_t amount);
 extern timestamp_t get_times();
 
 extern xsltStylesheetPtr get_stylesheet(const char *name);
+extern void flush_stylesheets(void);
+extern int parallel_thread_count(void);
+extern void run_in_parallel(void (*fn)(void *), void **data, int nr);
 
 extern timestamp_t utc_mktime(struct tm *tm);
 extern void utc_mkdate(timestamp_t, struct tm *tm);
@@ -627,9 +714,12 @@ extern void utc_mkdate(timestamp_t, struct tm *tm);
 extern struct dive *alloc_dive(void);
 extern void record_dive(struct dive *dive);
 extern void clear_dive(struct dive *dive);
+extern void free_dive(struct dive *dive);
 extern void copy_dive(struct dive *s, struct dive *d);
 extern void selective_copy_dive(struct dive *s, struct dive *d, struct dive_components what, bool clear);
 extern struct dive *clone_dive(struct dive *s);
+extern void dive_arena_free(void *p);
+extern void *dive_arena_realloc(void *p, size_t old_size, size_t size);
 
 extern struct sample *prepare_sample(struct divecomputer *dc);
 extern void finish_sample(struct divecomputer *dc);
@@ -653,6 +743,8 @@ extern void fill_default_cylinder(cylinder_t *cyl);
 extern void add_gas_switch_event(struct dive *dive, struct divecomputer *dc, int time, int idx);
 extern void add_event(struct divecomputer *dc, int time, int type, int flags, int value, const char *name);
 extern void remove_event(struct event *event);
+extern void clear_dc_events(struct divecomputer *dc);
+extern int event_upper_bound(const struct divecomputer *dc, int time);
 extern void update_event_name(struct dive *d, struct event* event, char *name);
 extern void per_cylinder_mean_depth(struct dive *dive, struct divecomputer *dc, int *mean, int *duration);
 extern int get_cylinder_index(struct dive *dive, struct event *ev);
@@ -776,12 +868,18 @@ extern void reset_cylinders(struct dive *dive, bool track_gas);
 #define STRTOD_NO_DOT 0x02
 #define STRTOD_NO_COMMA 0x04
 #define STRTOD_NO_EXPONENT 0x08
+extern char *intern_string(const char *s);
+extern void release_string(char *s);
+
 extern double strtod_flags(const char *str, const char **ptr, unsigned int flags);
 
 #define STRTOD_ASCII (STRTOD_NO_COMMA)
 
 #define ascii_strtod(str, ptr) strtod_flags(str, ptr, STRTOD_ASCII)
 
+extern long strtol_scaled(const char *str, const char **ptr, int decimals);
+extern int strtoseconds(const char *str, const char **ptr);
+
 extern void set_save_userid_local(short value);
 extern void set_userid(char *user_id);
 
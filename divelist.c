@@ -10,8 +10,21 @@
  * void get_dive_gas(struct dive *dive, int *o2_p, int *he_p, int *o2low_p)
  * int total_weight(struct dive *dive)
  * int get_divenr(struct dive *dive)
+ * struct dive *get_dive_by_uniq_id(int id)
+ * int get_idx_by_uniq_id(int id)
+ * int lookup_idx_by_uniq_id(int id)
+ * int next_merged_dive_id(void)
+ * void dive_id_index_add(int idx)
+ * void invalidate_dive_id_index(void)
+ * void build_dc_index(int nr)
+ * void dc_index_add(struct dive *dive)
+ * void free_dc_index(void)
+ * struct dive *dc_index_next_by_id(uint32_t deviceid, uint32_t diveid, int *pos)
+ * struct dive *dc_index_next_by_when(timestamp_t when, int *pos)
+ * struct dive *get_dive_by_uemis_diveid(uint32_t diveid, uint32_t deviceid)
  * double init_decompression(struct dive *dive)
  * void update_cylinder_related_info(struct dive *dive)
+ * void invalidate_oxygen_exposure(int idx)
  * void dump_trip_list(void)
  * dive_trip_t *find_matching_trip(timestamp_t when)
  * void insert_trip(dive_trip_t **dive_trip_p)
@@ -158,30 +171,6 @@ static int active_o2(struct dive *dive, struct divecomputer *dc, duration_t time
 	return get_o2(&gas);
 }
 
-/* calculate OTU for a dive - this only takes the first divecomputer into account */
-static int calculate_otu(struct dive *dive)
-{
-	int i;
-	double otu = 0.0;
-	struct divecomputer *dc = &dive->dc;
-
-	for (i = 1; i < dc->samples; i++) {
-		int t;
-		int po2;
-		struct sample *sample = dc->sample + i;
-		struct sample *psample = sample - 1;
-		t = sample->time.seconds - psample->time.seconds;
-		if (sample->po2.mbar) {
-			po2 = sample->po2.mbar;
-		} else {
-			int o2 = active_o2(dive, dc, sample->time);
-			po2 = o2 * depth_to_atm(sample->depth.mm, dive);
-		}
-		if (po2 >= 500)
-			otu += pow((po2 - 500) / 1000.0, 0.83) * t / 30.0;
-	}
-	return rint(otu);
-}
 /* calculate CNS for a dive - this only takes the first divecomputer into account */
 int const cns_table[][3] = {
 	/* po2, Maximum Single Exposure, Maximum 24 hour Exposure */
@@ -198,52 +187,38 @@ int const cns_table[][3] = {
 	{ 600, 720 * 60, 720 * 60 }
 };
 
-/* this only gets called if dive->maxcns == 0 which means we know that
- * none of the divecomputers has tracked any CNS for us
- * so we calculated it "by hand" */
-static int calculate_cns(struct dive *dive)
+/*
+ * OTU and CNS of a dive - this only takes the first divecomputer into account.
+ * 'cns' is what is left over from earlier dives. Both are summed up over
+ * the samples in one pass, as that is where the time goes.
+ */
+static void calculate_oxygen_exposure(struct dive *dive, double cns)
 {
-	int i, j, divenr;
-	double cns = 0.0;
+	int j;
+	double otu = 0.0;
 	struct divecomputer *dc = &dive->dc;
-	struct dive *prev_dive;
-	timestamp_t endtime;
+	struct sample_iter it;
+	const struct sample *sample;
+	uint32_t lasttime = 0;
 
-	/* shortcut */
-	if (dive->cns)
-		return dive->cns;
-	/*
-	 * Do we start with a cns loading from a previous dive?
-	 * Check if we did a dive 12 hours prior, and what cns we had from that.
-	 * Then apply ha 90min halftime to see whats left.
-	 */
-	divenr = get_divenr(dive);
-	if (divenr) {
-		prev_dive = get_dive(divenr - 1);
-		if (prev_dive) {
-			endtime = prev_dive->when + prev_dive->duration.seconds;
-			if (dive->when < (endtime + 3600 * 12)) {
-				cns = calculate_cns(prev_dive);
-				cns = cns * 1 / pow(2, (dive->when - endtime) / (90.0 * 60.0));
-			}
-		}
-	}
-	/* Caclulate the cns for each sample in this dive and sum them */
-	for (i = 1; i < dc->samples; i++) {
+	for_each_sample(it, dc, sample) {
 		int t;
 		int po2;
-		struct sample *sample = dc->sample + i;
-		struct sample *psample = sample - 1;
-		t = sample->time.seconds - psample->time.seconds;
+		t = sample->time.seconds - lasttime;
+		lasttime = sample->time.seconds;
+		/* the first sample just starts the clock */
+		if (it.i == 1)
+			continue;
 		if (sample->po2.mbar) {
 			po2 = sample->po2.mbar;
 		} else {
 			int o2 = active_o2(dive, dc, sample->time);
 			po2 = o2 * depth_to_atm(sample->depth.mm, dive);
 		}
-		/* CNS don't increse when below 500 matm */
+		/* neither OTU nor CNS increase when below 500 matm */
 		if (po2 < 500)
 			continue;
+		otu += pow((po2 - 500) / 1000.0, 0.83) * t / 30.0;
 		/* Find what table-row we should calculate % for */
 		for (j = 1; j < sizeof(cns_table) / (sizeof(int) * 3); j++)
 			if (po2 > cns_table[j][0])
@@ -251,10 +226,69 @@ static int calculate_cns(struct dive *dive)
 		j--;
 		cns += ((double)t) / ((double)cns_table[j][1]) * 100;
 	}
-	/* save calculated cns in dive struct */
+	dive->otu = rint(otu);
 	dive->cns = cns;
-	return dive->cns;
 }
+
+/*
+ * Do we start with a cns loading from a previous dive?
+ * Check if we did a dive 12 hours prior, and what cns we had from that.
+ * Then apply ha 90min halftime to see whats left.
+ * 'idx' is where the dive is (or would go) in the dive table.
+ */
+static double leftover_cns(struct dive *dive, int idx)
+{
+	struct dive *prev_dive = idx > 0 ? get_dive(idx - 1) : NULL;
+	timestamp_t endtime;
+
+	if (!prev_dive)
+		return 0.0;
+	endtime = prev_dive->when + prev_dive->duration.seconds;
+	if (dive->when >= endtime + 3600 * 12)
+		return 0.0;
+	return prev_dive->cns * 1 / pow(2, (dive->when - endtime) / (90.0 * 60.0));
+}
+
+/*
+ * As the CNS of a dive depends on the dives before it, the OTU and CNS
+ * of the dives in the dive table are computed in one forward pass in
+ * table (and thus time) order and kept in the dives. The first
+ * 'oxygen_exposure_valid' dives of the table are up to date; changes
+ * to a dive only invalidate the dives from that one on.
+ */
+static int oxygen_exposure_valid;
+
+void invalidate_oxygen_exposure(int idx)
+{
+	if (idx < 0)
+		idx = 0;
+	if (idx < oxygen_exposure_valid)
+		oxygen_exposure_valid = idx;
+}
+
+static void update_oxygen_exposure(struct dive *dive, int idx)
+{
+	int old_cns = dive->cns;
+
+	calculate_oxygen_exposure(dive, leftover_cns(dive, idx));
+	/* maxcns comes from the samples if the dive computer tracked CNS,
+	 * otherwise it's what we calculated (possibly on an earlier pass) */
+	if (dive->maxcns == 0 || dive->maxcns == old_cns)
+		dive->maxcns = dive->cns;
+}
+
+/* bring the dives up to and including 'idx' up to date */
+static void update_oxygen_exposure_upto(int idx)
+{
+	if (idx >= dive_table.nr)
+		idx = dive_table.nr - 1;
+	while (oxygen_exposure_valid <= idx) {
+		int i = oxygen_exposure_valid;
+		update_oxygen_exposure(get_dive(i), i);
+		oxygen_exposure_valid = i + 1;
+	}
+}
+
 /*
  * Return air usage (in liters).
  */
@@ -308,38 +342,414 @@ static int calculate_sac(struct dive *dive)
 static void add_dive_to_deco(struct dive *dive)
 {
 	struct divecomputer *dc = &dive->dc;
-	int i;
+	struct sample_iter it;
+	const struct sample *sample;
+	struct sample psample;
 
 	if (!dc)
 		return;
-	for (i = 1; i < dc->samples; i++) {
-		struct sample *psample = dc->sample + i - 1;
-		struct sample *sample = dc->sample + i;
-		int t0 = psample->time.seconds;
-		int t1 = sample->time.seconds;
-		int j;
+	for_each_sample(it, dc, sample) {
+		int t0, t1, j;
 
+		/* the iterator reuses its sample, so keep a copy of the previous one */
+		if (it.i == 1) {
+			psample = *sample;
+			continue;
+		}
+		t0 = psample.time.seconds;
+		t1 = sample->time.seconds;
 		for (j = t0; j < t1; j++) {
-			int depth = interpolate(psample->depth.mm, sample->depth.mm, j - t0, t1 - t0);
+			int depth = interpolate(psample.depth.mm, sample->depth.mm, j - t0, t1 - t0);
 			(void)add_segment(depth_to_mbar(depth, dive) / 1000.0,
 					  &dive->cylinder[sample->sensor].gasmix, 1, sample->po2.mbar, dive);
 		}
+		psample = *sample;
 	}
 }
 
-int get_divenr(struct dive *dive)
+/*
+ * Index from the unique dive id to the position of that dive in dive_table.
+ *
+ * This is a simple open addressing hash table with linear probing. It is
+ * kept up to date by record_dive(), add_single_dive() and delete_single_dive();
+ * operations that reorder the whole table (sort_table(), merging dives) just
+ * invalidate it and it gets rebuilt on the next lookup.
+ * As plenty of code still manipulates dive_table directly, every hit is
+ * verified against the table and a miss falls back to a linear scan.
+ */
+struct dive_id_entry {
+	int id;
+	int idx;
+};
+
+static struct {
+	int size, used;
+	bool valid;
+	struct dive_id_entry *entries;
+} dive_id_index;
+
+static inline unsigned int dive_id_hash(int id)
+{
+	unsigned int h = (unsigned int)id * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+static struct dive_id_entry *dive_id_slot(int id)
+{
+	unsigned int mask = dive_id_index.size - 1;
+	unsigned int i = dive_id_hash(id) & mask;
+
+	while (dive_id_index.entries[i].id && dive_id_index.entries[i].id != id)
+		i = (i + 1) & mask;
+	return dive_id_index.entries + i;
+}
+
+static void dive_id_index_insert(int id, int idx)
+{
+	struct dive_id_entry *entry;
+
+	if (!id)
+		return;
+	entry = dive_id_slot(id);
+	if (!entry->id) {
+		entry->id = id;
+		dive_id_index.used++;
+	}
+	entry->idx = idx;
+}
+
+static void rebuild_dive_id_index(void)
+{
+	int i, size = 64;
+	struct dive *dive;
+
+	/* keep the load factor below one half */
+	while (size < 2 * dive_table.nr + 2)
+		size *= 2;
+	if (size != dive_id_index.size) {
+		free(dive_id_index.entries);
+		dive_id_index.entries = malloc(size * sizeof(struct dive_id_entry));
+		if (!dive_id_index.entries)
+			exit(1);
+		dive_id_index.size = size;
+	}
+	memset(dive_id_index.entries, 0, size * sizeof(struct dive_id_entry));
+	dive_id_index.used = 0;
+	for_each_dive(i, dive)
+		dive_id_index_insert(dive->id, i);
+	dive_id_index.valid = true;
+}
+
+void invalidate_dive_id_index(void)
+{
+	dive_id_index.valid = false;
+}
+
+/* remove an entry without leaving a hole in the probe sequence */
+static void dive_id_index_remove(int id)
+{
+	unsigned int mask = dive_id_index.size - 1;
+	struct dive_id_entry *entry = dive_id_slot(id);
+	unsigned int i, j;
+
+	if (!entry->id)
+		return;
+	i = entry - dive_id_index.entries;
+	dive_id_index.used--;
+	for (j = (i + 1) & mask; dive_id_index.entries[j].id; j = (j + 1) & mask) {
+		unsigned int home = dive_id_hash(dive_id_index.entries[j].id) & mask;
+		/* can the entry at j be moved into the hole at i? */
+		if ((j > i && (home <= i || home > j)) ||
+		    (j < i && (home <= i && home > j))) {
+			dive_id_index.entries[i] = dive_id_index.entries[j];
+			i = j;
+		}
+	}
+	dive_id_index.entries[i].id = 0;
+}
+
+/* dives from 'from' to the end of the table have moved */
+static void dive_id_index_renumber(int from)
 {
 	int i;
-	struct dive *d;
+
+	for (i = from; i < dive_table.nr; i++)
+		dive_id_index_insert(dive_table.dives[i]->id, i);
+}
+
+/* a dive was inserted at 'idx', the ones after it moved up by one */
+void dive_id_index_add(int idx)
+{
+	if (!dive_id_index.valid)
+		return;
+	/* shifting most of the table costs as much as a rebuild */
+	if (2 * (dive_id_index.used + 1) > dive_id_index.size ||
+	    2 * (dive_table.nr - idx) > dive_table.nr) {
+		dive_id_index.valid = false;
+		return;
+	}
+	dive_id_index_renumber(idx);
+}
+
+static void dive_id_index_delete(int idx, int id)
+{
+	if (!dive_id_index.valid)
+		return;
+	if (2 * (dive_table.nr - idx) > dive_table.nr) {
+		dive_id_index.valid = false;
+		return;
+	}
+	dive_id_index_remove(id);
+	dive_id_index_renumber(idx);
+}
+
+static int linear_idx_by_uniq_id(int id)
+{
+	int i;
+	struct dive *dive;
+
+	for_each_dive(i, dive) {
+		if (dive->id == id)
+			return i;
+	}
+	return -1;
+}
+
+/* returns -1 if there is no dive with that id in the dive table */
+int lookup_idx_by_uniq_id(int id)
+{
+	struct dive_id_entry *entry;
+	int idx;
+
+	if (!dive_id_index.valid)
+		rebuild_dive_id_index();
+	entry = dive_id_slot(id);
+	if (entry->id == id) {
+		struct dive *dive = get_dive(entry->idx);
+		if (dive && dive->id == id)
+			return entry->idx;
+	}
+	/* somebody changed the table behind our back? */
+	idx = linear_idx_by_uniq_id(id);
+	if (idx >= 0)
+		dive_id_index.valid = false;
+	return idx;
+}
+
+struct dive *get_dive_by_uniq_id(int id)
+{
+	int idx = lookup_idx_by_uniq_id(id);
+#ifdef DEBUG
+	if (idx < 0) {
+		fprintf(stderr, "Invalid id %x passed to get_dive_by_diveid, try to fix the code\n", id);
+		exit(1);
+	}
+#endif
+	return get_dive(idx);
+}
+
+int get_idx_by_uniq_id(int id)
+{
+	int idx = lookup_idx_by_uniq_id(id);
+#ifdef DEBUG
+	if (idx < 0) {
+		fprintf(stderr, "Invalid id %x passed to get_dive_by_diveid, try to fix the code\n", id);
+		exit(1);
+	}
+#endif
+	return idx < 0 ? dive_table.nr : idx;
+}
+
+int get_divenr(struct dive *dive)
+{
 	// tempting as it may be, don't die when called with dive=NULL
-	if (dive)
-		for_each_dive(i, d) {
-			if (d->id == dive->id) // don't compare pointers, we could be passing in a copy of the dive
-				return i;
-		}
+	// and don't compare pointers, we could be passing in a copy of the dive
+	if (dive && dive->id)
+		return lookup_idx_by_uniq_id(dive->id);
 	return -1;
 }
 
+/*
+ * Index of the dive computers of the dives in dive_table, keyed by device
+ * and dive id and by start time. Downloads use it to check whether a dive
+ * is already in the log without matching it against every dive computer
+ * of every dive. It is built when a download starts, extended with the
+ * dives that download records and freed again at the end.
+ */
+struct dc_index_entry {
+	uint32_t deviceid, diveid;
+	timestamp_t when;
+	struct dive *dive;
+	int next_by_id, next_by_when;
+};
+
+static struct {
+	int nr, allocated, size;
+	bool valid;
+	int *by_id, *by_when;
+	struct dc_index_entry *entries;
+} dc_index;
+
+static inline unsigned int dc_id_hash(uint32_t deviceid, uint32_t diveid)
+{
+	unsigned int h = (deviceid * 31u + diveid) * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+static inline unsigned int dc_when_hash(timestamp_t when)
+{
+	unsigned int h = (unsigned int)(when ^ (when >> 32)) * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+static void dc_index_link(int i)
+{
+	struct dc_index_entry *entry = dc_index.entries + i;
+	unsigned int mask = dc_index.size - 1;
+	unsigned int h;
+
+	h = dc_id_hash(entry->deviceid, entry->diveid) & mask;
+	entry->next_by_id = dc_index.by_id[h];
+	dc_index.by_id[h] = i;
+	h = dc_when_hash(entry->when) & mask;
+	entry->next_by_when = dc_index.by_when[h];
+	dc_index.by_when[h] = i;
+}
+
+static void dc_index_rehash(int size)
+{
+	int i;
+
+	free(dc_index.by_id);
+	free(dc_index.by_when);
+	dc_index.by_id = malloc(size * sizeof(int));
+	dc_index.by_when = malloc(size * sizeof(int));
+	if (!dc_index.by_id || !dc_index.by_when)
+		exit(1);
+	/* all bits set is -1, the end of a chain */
+	memset(dc_index.by_id, 0xff, size * sizeof(int));
+	memset(dc_index.by_when, 0xff, size * sizeof(int));
+	dc_index.size = size;
+	for (i = 0; i < dc_index.nr; i++)
+		dc_index_link(i);
+}
+
+/* add a dive that was appended to the dive table to the index */
+void dc_index_add(struct dive *dive)
+{
+	struct divecomputer *dc;
+	struct dc_index_entry *entry;
+
+	if (!dc_index.valid || !dive)
+		return;
+	for_each_dc(dive, dc) {
+		if (dc_index.nr >= dc_index.allocated) {
+			int allocated = (dc_index.nr + 32) * 3 / 2;
+			entry = realloc(dc_index.entries, allocated * sizeof(struct dc_index_entry));
+			if (!entry)
+				exit(1);
+			dc_index.entries = entry;
+			dc_index.allocated = allocated;
+		}
+		entry = dc_index.entries + dc_index.nr++;
+		entry->deviceid = dc->deviceid;
+		entry->diveid = dc->diveid;
+		entry->when = dc->when;
+		entry->dive = dive;
+		if (2 * dc_index.nr > dc_index.size)
+			dc_index_rehash(2 * dc_index.size);
+		else
+			dc_index_link(dc_index.nr - 1);
+	}
+}
+
+/* index the dive computers of the first 'nr' dives of the dive table */
+void build_dc_index(int nr)
+{
+	int i;
+
+	dc_index.nr = 0;
+	dc_index.valid = true;
+	dc_index_rehash(64);
+	for (i = 0; i < nr && i < dive_table.nr; i++)
+		dc_index_add(get_dive(i));
+}
+
+void free_dc_index(void)
+{
+	free(dc_index.by_id);
+	free(dc_index.by_when);
+	free(dc_index.entries);
+	memset(&dc_index, 0, sizeof(dc_index));
+}
+
+/*
+ * Walk the indexed dives that have a dive computer with the given device
+ * and dive id. '*pos' has to be -1 for the first call. A dive can be
+ * returned more than once if several of its dive computers match.
+ */
+struct dive *dc_index_next_by_id(uint32_t deviceid, uint32_t diveid, int *pos)
+{
+	int i;
+
+	if (!dc_index.valid)
+		return NULL;
+	if (*pos < 0)
+		i = dc_index.by_id[dc_id_hash(deviceid, diveid) & (dc_index.size - 1)];
+	else
+		i = dc_index.entries[*pos].next_by_id;
+	for (; i >= 0; i = dc_index.entries[i].next_by_id) {
+		struct dc_index_entry *entry = dc_index.entries + i;
+		if (entry->deviceid == deviceid && entry->diveid == diveid) {
+			*pos = i;
+			return entry->dive;
+		}
+	}
+	return NULL;
+}
+
+/* same as above for the dives with a dive computer starting at 'when' */
+struct dive *dc_index_next_by_when(timestamp_t when, int *pos)
+{
+	int i;
+
+	if (!dc_index.valid)
+		return NULL;
+	if (*pos < 0)
+		i = dc_index.by_when[dc_when_hash(when) & (dc_index.size - 1)];
+	else
+		i = dc_index.entries[*pos].next_by_when;
+	for (; i >= 0; i = dc_index.entries[i].next_by_when) {
+		struct dc_index_entry *entry = dc_index.entries + i;
+		if (entry->when == when) {
+			*pos = i;
+			return entry->dive;
+		}
+	}
+	return NULL;
+}
+
+struct dive *get_dive_by_uemis_diveid(uint32_t diveid, uint32_t deviceid)
+{
+	int i, pos = -1, first = -1;
+	struct dive *dive;
+
+	if (dc_index.valid) {
+		/* chains run newest first, we want the first match in table order */
+		while (dc_index_next_by_id(deviceid, diveid, &pos))
+			first = pos;
+		return first < 0 ? NULL : dc_index.entries[first].dive;
+	}
+	for_each_dive (i, dive) {
+		struct divecomputer *dc = &dive->dc;
+		do {
+			if (dc->diveid == diveid && dc->deviceid == deviceid)
+				return dive;
+		} while ((dc = dc->next) != NULL);
+	}
+	return NULL;
+}
+
 static struct gasmix air = { .o2.permille = O2_IN_AIR, .he.permille = 0 };
 
 /* take into account previous dives until there is a 48h gap between dives */
@@ -426,11 +836,20 @@ double init_decompression(struct dive *dive)
 
 void update_cylinder_related_info(struct dive *dive)
 {
+	int idx;
+
 	if (dive != NULL) {
 		dive->sac = calculate_sac(dive);
-		dive->otu = calculate_otu(dive);
-		if (dive->maxcns == 0)
-			dive->maxcns = calculate_cns(dive);
+		idx = get_divenr(dive);
+		if (idx >= 0 && get_dive(idx) == dive) {
+			update_oxygen_exposure_upto(idx);
+			update_dive_summary(idx);
+			return;
+		}
+		/* a copy of a dive in the table, or a dive that isn't in the
+		 * table (then idx is -1 and nothing carries over) */
+		update_oxygen_exposure_upto(idx - 1);
+		update_oxygen_exposure(dive, idx);
 	}
 }
 
@@ -645,6 +1064,7 @@ void remove_dive_from_trip(struct dive *dive, short was_autogen)
 		delete_trip(trip);
 	else if (trip->when == dive->when)
 		find_new_trip_start_time(trip);
+	update_dive_summary(get_divenr(dive));
 }
 
 void add_dive_to_trip(struct dive *dive, dive_trip_t *trip)
@@ -666,6 +1086,7 @@ void add_dive_to_trip(struct dive *dive, dive_trip_t *trip)
 
 	if (dive->when && trip->when > dive->when)
 		trip->when = dive->when;
+	update_dive_summary(get_divenr(dive));
 }
 
 dive_trip_t *create_and_hookup_trip_from_dive(struct dive *dive)
@@ -736,15 +1157,11 @@ void delete_single_dive(int idx)
 	for (i = idx; i < dive_table.nr - 1; i++)
 		dive_table.dives[i] = dive_table.dives[i + 1];
 	dive_table.dives[--dive_table.nr] = NULL;
-	/* free all allocations */
-	free(dive->dc.sample);
-	free((void *)dive->location);
-	free((void *)dive->notes);
-	free((void *)dive->divemaster);
-	free((void *)dive->buddy);
-	free((void *)dive->suit);
-	taglist_free(dive->tag_list);
-	free(dive);
+	dive_id_index_delete(idx, dive->id);
+	invalidate_oxygen_exposure(idx);
+	invalidate_dive_summary(idx);
+	remove_dive_text_index(dive);
+	free_dive(dive);
 }
 
 void add_single_dive(int idx, struct dive *dive)
@@ -758,6 +1175,9 @@ void add_single_dive(int idx, struct dive *dive)
 		dive_table.dives[i] = dive;
 		dive = tmp;
 	}
+	dive_id_index_add(idx);
+	invalidate_oxygen_exposure(idx);
+	invalidate_dive_summary(idx);
 }
 
 bool consecutive_selected()
@@ -807,6 +1227,7 @@ struct dive *merge_two_dives(struct dive *a, struct dive *b)
 	// why?
 	// because this way one of the previously selected ids is still around
 	res->id = id;
+	invalidate_dive_id_index();
 	mark_divelist_changed(true);
 	return res;
 }
@@ -970,11 +1391,124 @@ static void try_to_renumber(struct dive *last, int preexisting)
 	}
 }
 
+/*
+ * Ids of the dives that merging replaced with a new dive under the same
+ * id, so the UI can refresh whatever it remembers about them.
+ */
+static struct {
+	int nr, allocated;
+	int *ids;
+} merged_dives;
+
+static void remember_merged_dive(int id)
+{
+	if (merged_dives.nr >= merged_dives.allocated) {
+		int allocated = (merged_dives.nr + 16) * 3 / 2;
+		int *ids = realloc(merged_dives.ids, allocated * sizeof(int));
+		if (!ids)
+			exit(1);
+		merged_dives.ids = ids;
+		merged_dives.allocated = allocated;
+	}
+	merged_dives.ids[merged_dives.nr++] = id;
+}
+
+/* returns the id of a dive that was merged since the last call, or 0 */
+int next_merged_dive_id(void)
+{
+	if (!merged_dives.nr)
+		return 0;
+	return merged_dives.ids[--merged_dives.nr];
+}
+
+/*
+ * Merge overlapping dives of the sorted dive table in one sweep.
+ *
+ * Surviving and merged dives are written into a new array, rather than
+ * inserting the merged dive and deleting the two originals in dive_table
+ * one at a time (which shifts the tail of the table three times for
+ * every merge). Trips are fixed up as we go, the selection is recounted
+ * once at the end.
+ */
+static void merge_overlapping_dives(bool prefer_imported, struct dive **lastp, struct dive **currentp)
+{
+	int i, nr;
+	struct dive **dives;
+	bool merged_any = false;
+
+	if (dive_table.nr < 2)
+		return;
+	dives = malloc(dive_table.allocated * sizeof(struct dive *));
+	if (!dives)
+		exit(1);
+	dives[0] = dive_table.dives[0];
+	nr = 1;
+	for (i = 1; i < dive_table.nr; i++) {
+		struct dive *prev = dives[nr - 1];
+		struct dive *dive = dive_table.dives[i];
+		struct dive *merged;
+
+		/* only try to merge overlapping dives - or if one of the dives has
+		 * zero duration (that might be a gps marker from the webservice) */
+		if (prev->duration.seconds && dive->duration.seconds &&
+		    prev->when + prev->duration.seconds < dive->when) {
+			dives[nr++] = dive;
+			continue;
+		}
+
+		merged = try_to_merge(prev, dive, prefer_imported);
+		if (!merged) {
+			dives[nr++] = dive;
+			continue;
+		}
+
+		/* neither of them is in the table any more; the merged dive
+		 * gets indexed the next time the text is searched */
+		remove_dive_text_index(prev);
+		remove_dive_text_index(dive);
+
+		// keep the id or the first dive for the merged dive
+		merged->id = prev->id;
+		remember_merged_dive(merged->id);
+
+		/* careful - we might free the dive that last points to. Oops... */
+		if (*lastp == prev || *lastp == dive)
+			*lastp = merged;
+		if (*currentp == prev || *currentp == dive)
+			*currentp = merged;
+
+		/* the merged dive replaces the earlier one and can
+		 * in turn be merged with the next dive */
+		remove_dive_from_trip(prev, false);
+		remove_dive_from_trip(dive, false);
+		free_dive(prev);
+		free_dive(dive);
+		dives[nr - 1] = merged;
+		merged_any = true;
+	}
+	if (!merged_any) {
+		free(dives);
+		return;
+	}
+	free(dive_table.dives);
+	dive_table.dives = dives;
+	dive_table.nr = nr;
+	invalidate_dive_id_index();
+	invalidate_oxygen_exposure(0);
+	invalidate_dive_summary(0);
+
+	amount_selected = 0;
+	for (i = 0; i < nr; i++) {
+		if (dives[i]->selected)
+			amount_selected++;
+	}
+}
+
 void process_dives(bool is_imported, bool prefer_imported)
 {
 	int i;
 	int preexisting = dive_table.preexisting;
-	struct dive *last;
+	struct dive *last, *current = current_dive;
 
 	/* check if we need a nickname for the divecomputer for newly downloaded dives;
 	 * since we know they all came from the same divecomputer we just check for the
@@ -993,39 +1527,11 @@ void process_dives(bool is_imported, bool prefer_imported)
 	last = get_dive(preexisting - 1);
 
 	sort_table(&dive_table);
+	merge_overlapping_dives(prefer_imported, &last, &current);
+	/* the selected dive may have moved (or been merged) */
+	if (current)
+		selected_dive = get_divenr(current);
 
-	for (i = 1; i < dive_table.nr; i++) {
-		struct dive **pp = &dive_table.dives[i - 1];
-		struct dive *prev = pp[0];
-		struct dive *dive = pp[1];
-		struct dive *merged;
-		int id;
-
-		/* only try to merge overlapping dives - or if one of the dives has
-		 * zero duration (that might be a gps marker from the webservice) */
-		if (prev->duration.seconds && dive->duration.seconds &&
-		    prev->when + prev->duration.seconds < dive->when)
-			continue;
-
-		merged = try_to_merge(prev, dive, prefer_imported);
-		if (!merged)
-			continue;
-
-		// remember the earlier dive's id
-		id = prev->id;
-
-		/* careful - we might free the dive that last points to. Oops... */
-		if (last == prev || last == dive)
-			last = merged;
-
-		/* Redo the new 'i'th dive */
-		i--;
-		add_single_dive(i, merged);
-		delete_single_dive(i + 1);
-		delete_single_dive(i + 1);
-		// keep the id or the first dive for the merged dive
-		merged->id = id;
-	}
 	/* make sure no dives are still marked as downloaded */
 	for (i = 1; i < dive_table.nr; i++)
 		dive_table.dives[i]->downloaded = false;
@@ -1039,6 +1545,7 @@ void process_dives(bool is_imported, bool prefer_imported)
 		if (preexisting != dive_table.nr)
 			mark_divelist_changed(true);
 	}
+	pack_dive_table();
 }
 
 void set_dive_nr_for_current_dive()
@@ -0,0 +1,613 @@
+/*
+ * Small query language over the dive table (see divequery.h).
+ *
+ * A query is parsed into a tree once; running it produces a bitmap with
+ * one bit per dive in dive_table, like the tag bitmaps. The numeric
+ * comparisons are answered from per-field sorted indexes over the dive
+ * summary with two binary searches, tags from the tag bitmaps, and
+ * 'and', 'or' and 'not' are word-wise operations on the bitmaps. Only the
+ * text fields need to look at the dives themselves.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "dive.h"
+#include "divequery.h"
+
+enum query_field {
+	F_DEPTH, F_MEANDEPTH, F_DURATION, F_SAC, F_TEMP, F_RATING, F_YEAR, F_MONTH,
+	NUMERIC_FIELDS,
+	F_LOCATION = NUMERIC_FIELDS, F_BUDDY, F_DIVEMASTER, F_SUIT, F_NOTES,
+	F_TAG,
+	QUERY_FIELDS
+};
+
+static const char *field_names[QUERY_FIELDS] = {
+	"depth", "meandepth", "duration", "sac", "temp", "rating", "year", "month",
+	"location", "buddy", "divemaster", "suit", "notes",
+	"tag"
+};
+
+enum query_cmp { CMP_EQ, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE, CMP_CONTAINS };
+
+enum node_type { N_AND, N_OR, N_NOT, N_NUMBER, N_TEXT, N_TAG, N_ANYTEXT };
+
+struct query_node {
+	enum node_type type;
+	struct query_node *a, *b;
+	enum query_field field;
+	enum query_cmp cmp;
+	int value;
+	char *text;
+};
+
+struct dive_query {
+	struct query_node *root;
+	bool uses_tags;
+};
+
+/* tokenizer */
+enum token_type { T_END, T_WORD, T_STRING, T_LPAREN, T_RPAREN, T_CMP };
+
+struct query_parser {
+	const char *pos;
+	enum token_type type;
+	enum query_cmp cmp;
+	char *text;
+	bool uses_tags;
+};
+
+static bool is_word_char(char c)
+{
+	return c && !strchr(" \t\r\n()=<>!~\"", c);
+}
+
+/* no strndup() on Windows */
+static char *copy_token(const char *start, size_t len)
+{
+	char *text = malloc(len + 1);
+
+	if (!text)
+		exit(1);
+	memcpy(text, start, len);
+	text[len] = '\0';
+	return text;
+}
+
+static void next_token(struct query_parser *p)
+{
+	const char *s = p->pos, *start;
+
+	free(p->text);
+	p->text = NULL;
+	while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+		s++;
+	switch (*s) {
+	case '\0':
+		p->type = T_END;
+		break;
+	case '(':
+		p->type = T_LPAREN;
+		s++;
+		break;
+	case ')':
+		p->type = T_RPAREN;
+		s++;
+		break;
+	case '=':
+		p->type = T_CMP;
+		p->cmp = CMP_EQ;
+		s++;
+		break;
+	case '~':
+		p->type = T_CMP;
+		p->cmp = CMP_CONTAINS;
+		s++;
+		break;
+	case '!':
+	case '<':
+	case '>':
+		p->type = T_CMP;
+		if (s[1] == '=') {
+			p->cmp = *s == '!' ? CMP_NE : *s == '<' ? CMP_LE : CMP_GE;
+			s += 2;
+		} else {
+			/* a lone '!' is taken as "not equal", too */
+			p->cmp = *s == '!' ? CMP_NE : *s == '<' ? CMP_LT : CMP_GT;
+			s++;
+		}
+		break;
+	case '"':
+		start = ++s;
+		while (*s && *s != '"')
+			s++;
+		p->type = T_STRING;
+		p->text = copy_token(start, s - start);
+		if (*s)
+			s++;
+		break;
+	default:
+		start = s;
+		while (is_word_char(*s))
+			s++;
+		p->text = copy_token(start, s - start);
+		if (!strcasecmp(p->text, "contains")) {
+			p->type = T_CMP;
+			p->cmp = CMP_CONTAINS;
+		} else {
+			p->type = T_WORD;
+		}
+		break;
+	}
+	p->pos = s;
+}
+
+static bool is_keyword(struct query_parser *p, const char *keyword)
+{
+	return p->type == T_WORD && !strcasecmp(p->text, keyword);
+}
+
+static struct query_node *new_node(enum node_type type, struct query_node *a, struct query_node *b)
+{
+	struct query_node *node = calloc(1, sizeof(*node));
+
+	if (!node)
+		exit(1);
+	node->type = type;
+	node->a = a;
+	node->b = b;
+	return node;
+}
+
+static void free_node(struct query_node *node)
+{
+	if (!node)
+		return;
+	free_node(node->a);
+	free_node(node->b);
+	free(node->text);
+	free(node);
+}
+
+static int find_field(const char *name)
+{
+	int i;
+
+	for (i = 0; i < QUERY_FIELDS; i++)
+		if (!strcasecmp(name, field_names[i]))
+			return i;
+	return -1;
+}
+
+/* convert a value in user units to the units the dive summary uses */
+static bool numeric_value(enum query_field field, const char *text, int *value)
+{
+	const char *end;
+	double v = ascii_strtod(text, &end);
+
+	if (end == text || *end)
+		return false;
+	switch (field) {
+	case F_DEPTH:
+	case F_MEANDEPTH:
+		*value = units_to_depth(v);
+		break;
+	case F_DURATION:
+		*value = rint(v * 60);
+		break;
+	case F_SAC:
+		*value = units_to_sac(v);
+		break;
+	case F_TEMP:
+		*value = get_units()->temperature == FAHRENHEIT ? F_to_mkelvin(v) : C_to_mkelvin(v);
+		break;
+	default:
+		*value = rint(v);
+		break;
+	}
+	return true;
+}
+
+static struct query_node *parse_or(struct query_parser *p);
+
+static struct query_node *parse_term(struct query_parser *p)
+{
+	struct query_node *node;
+	char *word = p->text;
+	bool quoted = p->type == T_STRING;
+	int field;
+
+	p->text = NULL;
+	next_token(p);
+	if (p->type != T_CMP) {
+		node = new_node(N_ANYTEXT, NULL, NULL);
+		node->text = word;
+		return node;
+	}
+	field = quoted ? -1 : find_field(word);
+	free(word);
+	if (field < 0)
+		return NULL;
+	node = new_node(field < NUMERIC_FIELDS ? N_NUMBER : field == F_TAG ? N_TAG : N_TEXT, NULL, NULL);
+	node->field = field;
+	node->cmp = p->cmp;
+	next_token(p);
+	if (p->type != T_WORD && p->type != T_STRING)
+		goto error;
+	if (node->type == N_NUMBER) {
+		if (node->cmp == CMP_CONTAINS || !numeric_value(field, p->text, &node->value))
+			goto error;
+	} else {
+		if (node->cmp != CMP_EQ && node->cmp != CMP_NE && node->cmp != CMP_CONTAINS)
+			goto error;
+		node->text = p->text;
+		p->text = NULL;
+		if (node->type == N_TAG)
+			p->uses_tags = true;
+	}
+	next_token(p);
+	return node;
+
+error:
+	free_node(node);
+	return NULL;
+}
+
+static struct query_node *parse_unary(struct query_parser *p)
+{
+	struct query_node *node;
+
+	if (is_keyword(p, "not")) {
+		next_token(p);
+		node = parse_unary(p);
+		return node ? new_node(N_NOT, node, NULL) : NULL;
+	}
+	if (p->type == T_LPAREN) {
+		next_token(p);
+		node = parse_or(p);
+		if (node && p->type != T_RPAREN) {
+			free_node(node);
+			return NULL;
+		}
+		next_token(p);
+		return node;
+	}
+	if (p->type == T_WORD || p->type == T_STRING)
+		return parse_term(p);
+	return NULL;
+}
+
+static struct query_node *parse_and(struct query_parser *p)
+{
+	struct query_node *left = parse_unary(p), *right;
+
+	while (left) {
+		if (is_keyword(p, "and"))
+			next_token(p);
+		else if (is_keyword(p, "or") || (p->type != T_WORD && p->type != T_STRING && p->type != T_LPAREN))
+			break;
+		right = parse_unary(p);
+		if (!right) {
+			free_node(left);
+			return NULL;
+		}
+		left = new_node(N_AND, left, right);
+	}
+	return left;
+}
+
+static struct query_node *parse_or(struct query_parser *p)
+{
+	struct query_node *left = parse_and(p), *right;
+
+	while (left && is_keyword(p, "or")) {
+		next_token(p);
+		right = parse_and(p);
+		if (!right) {
+			free_node(left);
+			return NULL;
+		}
+		left = new_node(N_OR, left, right);
+	}
+	return left;
+}
+
+/* returns NULL for an empty or invalid query */
+struct dive_query *compile_dive_query(const char *text)
+{
+	struct query_parser p = { text };
+	struct query_node *root;
+	struct dive_query *query;
+
+	next_token(&p);
+	if (p.type == T_END)
+		return NULL;
+	root = parse_or(&p);
+	if (root && p.type != T_END) {
+		free_node(root);
+		root = NULL;
+	}
+	free(p.text);
+	if (!root)
+		return NULL;
+	query = malloc(sizeof(*query));
+	if (!query)
+		exit(1);
+	query->root = root;
+	query->uses_tags = p.uses_tags;
+	return query;
+}
+
+void free_dive_query(struct dive_query *query)
+{
+	if (!query)
+		return;
+	free_node(query->root);
+	free(query);
+}
+
+/* sorted indexes of the numeric fields, rebuilt when the summary changes */
+static struct {
+	unsigned int generation;
+	int nr;
+	int *order;
+} numeric_index[NUMERIC_FIELDS];
+
+static const int *field_column(const struct dive_summary *s, enum query_field field)
+{
+	switch (field) {
+	case F_DEPTH: return s->maxdepth;
+	case F_MEANDEPTH: return s->meandepth;
+	case F_DURATION: return s->duration;
+	case F_SAC: return s->sac;
+	case F_TEMP: return s->watertemp;
+	case F_RATING: return s->rating;
+	case F_YEAR: return s->year;
+	case F_MONTH: return s->month;
+	default: return NULL;
+	}
+}
+
+static const int *sort_column;
+
+static int sort_by_column(const void *_a, const void *_b)
+{
+	int a = *(const int *)_a, b = *(const int *)_b;
+
+	if (sort_column[a] != sort_column[b])
+		return sort_column[a] < sort_column[b] ? -1 : 1;
+	return a - b;
+}
+
+static const int *get_numeric_index(const struct dive_summary *s, enum query_field field)
+{
+	int i;
+
+	if (numeric_index[field].order && numeric_index[field].generation == s->generation &&
+	    numeric_index[field].nr == s->nr)
+		return numeric_index[field].order;
+	free(numeric_index[field].order);
+	numeric_index[field].order = malloc((s->nr + 1) * sizeof(int));
+	if (!numeric_index[field].order)
+		exit(1);
+	for (i = 0; i < s->nr; i++)
+		numeric_index[field].order[i] = i;
+	sort_column = field_column(s, field);
+	qsort(numeric_index[field].order, s->nr, sizeof(int), sort_by_column);
+	numeric_index[field].generation = s->generation;
+	numeric_index[field].nr = s->nr;
+	return numeric_index[field].order;
+}
+
+/* the first position in 'order' whose value is >= value (or > value if 'after') */
+static int index_bound(const int *column, const int *order, int nr, int value, bool after)
+{
+	int low = 0, high = nr;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+		int v = column[order[mid]];
+		if (v < value || (after && v == value))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* in the summary, 0 means that the dive doesn't have that value */
+static bool zero_is_unknown(enum query_field field)
+{
+	return field == F_MEANDEPTH || field == F_SAC || field == F_TEMP || field == F_RATING;
+}
+
+/* set the bits of order[from..to), leaving out order[skip_from..skip_to) */
+static void set_index_range(uint32_t *bitmap, const int *order, int from, int to, int skip_from, int skip_to)
+{
+	for (; from < to; from++) {
+		int idx;
+
+		if (from >= skip_from && from < skip_to) {
+			from = skip_to - 1;
+			continue;
+		}
+		idx = order[from];
+		bitmap[idx / 32] |= 1u << (idx & 31);
+	}
+}
+
+static bool contains_nocase(const char *haystack, const char *needle)
+{
+	size_t len = strlen(needle);
+
+	if (!len)
+		return true;
+	if (!haystack)
+		return false;
+	for (; *haystack; haystack++)
+		if (!strncasecmp(haystack, needle, len))
+			return true;
+	return false;
+}
+
+static bool text_matches(const char *text, enum query_cmp cmp, const char *value)
+{
+	if (cmp == CMP_CONTAINS)
+		return contains_nocase(text, value);
+	return !strcasecmp(text ?: "", value) == (cmp == CMP_EQ);
+}
+
+static const char *dive_text(const struct dive *dive, enum query_field field)
+{
+	switch (field) {
+	case F_LOCATION: return dive->location;
+	case F_BUDDY: return dive->buddy;
+	case F_DIVEMASTER: return dive->divemaster;
+	case F_SUIT: return dive->suit;
+	case F_NOTES: return dive->notes;
+	default: return NULL;
+	}
+}
+
+/* or the bitmaps of all tags that match into the result */
+static void match_tags(uint32_t *bitmap, int words, enum query_cmp cmp, const char *value)
+{
+	struct tag_entry *entry;
+	int i;
+
+	for (entry = g_tag_list; entry; entry = entry->next) {
+		struct divetag *tag = entry->tag;
+		const uint32_t *bits;
+
+		if (cmp == CMP_CONTAINS) {
+			if (!contains_nocase(tag->name, value) && !(tag->source && contains_nocase(tag->source, value)))
+				continue;
+		} else if (strcasecmp(tag->name, value) && !(tag->source && !strcasecmp(tag->source, value))) {
+			continue;
+		}
+		bits = tag_dive_bitmap(tag->id);
+		if (!bits)
+			continue;
+		for (i = 0; i < words; i++)
+			bitmap[i] |= bits[i];
+	}
+}
+
+static void invert_bitmap(uint32_t *bitmap, int nr)
+{
+	int i, words = DIVE_BITMAP_WORDS(nr);
+
+	for (i = 0; i < words; i++)
+		bitmap[i] = ~bitmap[i];
+	if (nr & 31)
+		bitmap[words - 1] &= (1u << (nr & 31)) - 1;
+}
+
+static void eval_node(const struct query_node *node, const struct dive_summary *s, uint32_t *bitmap)
+{
+	int i, words = DIVE_BITMAP_WORDS(s->nr);
+	uint32_t *other;
+	struct dive *dive;
+
+	memset(bitmap, 0, words * sizeof(uint32_t));
+	switch (node->type) {
+	case N_AND:
+	case N_OR:
+		other = malloc((words + 1) * sizeof(uint32_t));
+		if (!other)
+			exit(1);
+		eval_node(node->a, s, bitmap);
+		eval_node(node->b, s, other);
+		for (i = 0; i < words; i++)
+			bitmap[i] = node->type == N_AND ? bitmap[i] & other[i] : bitmap[i] | other[i];
+		free(other);
+		break;
+	case N_NOT:
+		eval_node(node->a, s, bitmap);
+		invert_bitmap(bitmap, s->nr);
+		break;
+	case N_NUMBER: {
+		const int *column = field_column(s, node->field);
+		const int *order = get_numeric_index(s, node->field);
+		int first = index_bound(column, order, s->nr, node->value, false);
+		int last = index_bound(column, order, s->nr, node->value, true);
+		int unknown = 0, known = 0;
+
+		/* dives without the value don't match any comparison on it */
+		if (zero_is_unknown(node->field)) {
+			unknown = index_bound(column, order, s->nr, 0, false);
+			known = index_bound(column, order, s->nr, 0, true);
+		}
+		switch (node->cmp) {
+		case CMP_EQ:
+			set_index_range(bitmap, order, first, last, unknown, known);
+			break;
+		case CMP_NE:
+			set_index_range(bitmap, order, 0, first, unknown, known);
+			set_index_range(bitmap, order, last, s->nr, unknown, known);
+			break;
+		case CMP_LT:
+			set_index_range(bitmap, order, 0, first, unknown, known);
+			break;
+		case CMP_LE:
+			set_index_range(bitmap, order, 0, last, unknown, known);
+			break;
+		case CMP_GT:
+			set_index_range(bitmap, order, last, s->nr, unknown, known);
+			break;
+		case CMP_GE:
+			set_index_range(bitmap, order, first, s->nr, unknown, known);
+			break;
+		default:
+			break;
+		}
+		break;
+	}
+	case N_TEXT:
+		for (i = 0; i < s->nr; i++) {
+			dive = dive_table.dives[i];
+			if (text_matches(dive_text(dive, node->field), node->cmp, node->text))
+				bitmap[i / 32] |= 1u << (i & 31);
+		}
+		break;
+	case N_TAG:
+		match_tags(bitmap, words, node->cmp == CMP_NE ? CMP_EQ : node->cmp, node->text);
+		if (node->cmp == CMP_NE)
+			invert_bitmap(bitmap, s->nr);
+		break;
+	case N_ANYTEXT:
+		/* words are looked up in the text index, by their beginning */
+		if (search_dive_text(node->text, bitmap))
+			break;
+		for (i = 0; i < s->nr; i++) {
+			enum query_field field;
+
+			dive = dive_table.dives[i];
+			for (field = F_LOCATION; field < F_TAG; field++) {
+				if (contains_nocase(dive_text(dive, field), node->text)) {
+					bitmap[i / 32] |= 1u << (i & 31);
+					break;
+				}
+			}
+		}
+		break;
+	}
+}
+
+/*
+ * Fill in one bit per dive in dive_table (DIVE_BITMAP_WORDS(dive_table.nr)
+ * words) for the dives matching the query, and return how many do.
+ */
+int run_dive_query(struct dive_query *query, uint32_t *bitmap)
+{
+	const struct dive_summary *s = get_dive_summary();
+	int i, count = 0, words = DIVE_BITMAP_WORDS(s->nr);
+
+	/* the tag bitmaps don't notice when the tags of a dive are edited */
+	if (query->uses_tags)
+		invalidate_tag_bitmaps();
+	eval_node(query->root, s, bitmap);
+	for (i = 0; i < words; i++)
+		count += __builtin_popcount(bitmap[i]);
+	return count;
+}
@@ -0,0 +1,34 @@
+#ifndef DIVEQUERY_H
+#define DIVEQUERY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Queries over the dive table, like
+ *
+ *	depth > 40 and tag = wreck and year = 2013 and buddy ~ "Jane"
+ *
+ * Comparisons are field, operator, value: the numeric fields depth,
+ * meandepth, duration (minutes), sac, temp, rating, year and month take
+ * = != < <= > >=, the text fields location, buddy, divemaster, suit and
+ * notes take = (whole text) and ~ or 'contains', and tag takes = and !=.
+ * Values are in the units the user has picked. Dives that don't have a
+ * mean depth, sac, water temperature or rating don't match comparisons
+ * on that field. Terms can be combined with and, or, not and
+ * parentheses; terms next to each other are and'ed.
+ * Words on their own match dives that have words starting with them in
+ * any of the text fields or tags, so "wre" finds wrecks.
+ */
+struct dive_query;
+
+extern struct dive_query *compile_dive_query(const char *text);
+extern void free_dive_query(struct dive_query *query);
+extern int run_dive_query(struct dive_query *query, uint32_t *bitmap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIVEQUERY_H
@@ -0,0 +1,125 @@
+/*
+ * Column store of the per-dive values that the statistics, the yearly,
+ * monthly and trip summaries and the globe look at.
+ *
+ * Those all walk every dive in the table but only use a handful of
+ * scalars from each, which in 'struct dive' are spread over a big
+ * structure that is mostly cylinders, weights and strings. Keeping the
+ * scalars in one array per value turns those passes into streaming
+ * reads of a few small arrays.
+ *
+ * Row i always describes dive_table.dives[i]. Like the oxygen exposure
+ * the rows are kept up to date lazily: the first 'valid' rows are
+ * current, adding, removing or moving dives invalidates the rows from
+ * that point on and get_dive_summary() refills whatever is stale.
+ * A change to just the values of one dive can refresh its row in place
+ * through update_dive_summary(). Either way the statistics built from
+ * the summary get told which rows changed.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "dive.h"
+#include "statistics.h"
+
+static struct dive_summary summary;
+static int summary_valid;
+
+static void *grow_column(void *column, size_t size, int nr)
+{
+	column = realloc(column, size * nr);
+	if (!column)
+		exit(1);
+	return column;
+}
+
+static void grow_dive_summary(int nr)
+{
+	int allocated = (nr + 32) * 3 / 2;
+
+	summary.when = grow_column(summary.when, sizeof(*summary.when), allocated);
+	summary.year = grow_column(summary.year, sizeof(*summary.year), allocated);
+	summary.month = grow_column(summary.month, sizeof(*summary.month), allocated);
+	summary.duration = grow_column(summary.duration, sizeof(*summary.duration), allocated);
+	summary.maxdepth = grow_column(summary.maxdepth, sizeof(*summary.maxdepth), allocated);
+	summary.meandepth = grow_column(summary.meandepth, sizeof(*summary.meandepth), allocated);
+	summary.sac = grow_column(summary.sac, sizeof(*summary.sac), allocated);
+	summary.mintemp = grow_column(summary.mintemp, sizeof(*summary.mintemp), allocated);
+	summary.maxtemp = grow_column(summary.maxtemp, sizeof(*summary.maxtemp), allocated);
+	summary.watertemp = grow_column(summary.watertemp, sizeof(*summary.watertemp), allocated);
+	summary.rating = grow_column(summary.rating, sizeof(*summary.rating), allocated);
+	summary.latitude = grow_column(summary.latitude, sizeof(*summary.latitude), allocated);
+	summary.longitude = grow_column(summary.longitude, sizeof(*summary.longitude), allocated);
+	summary.trip = grow_column(summary.trip, sizeof(*summary.trip), allocated);
+	summary.allocated = allocated;
+}
+
+#define SET(column, value)				\
+	do {						\
+		if (summary.column[i] != (value)) {	\
+			summary.column[i] = (value);	\
+			changed = true;			\
+		}					\
+	} while (0)
+
+/* returns whether anything in the row changed */
+static bool fill_row(int i, const struct dive *dive)
+{
+	struct tm tm;
+	bool changed = false;
+
+	utc_mkdate(dive->when, &tm);
+	SET(when, dive->when);
+	SET(year, tm.tm_year + 1900);
+	SET(month, tm.tm_mon + 1);
+	SET(duration, dive->duration.seconds);
+	SET(maxdepth, dive->maxdepth.mm);
+	SET(meandepth, dive->meandepth.mm);
+	SET(sac, dive->sac);
+	SET(mintemp, dive->mintemp.mkelvin);
+	SET(maxtemp, dive->maxtemp.mkelvin);
+	SET(watertemp, dive->watertemp.mkelvin);
+	SET(rating, dive->rating);
+	SET(latitude, dive->latitude.udeg);
+	SET(longitude, dive->longitude.udeg);
+	SET(trip, dive->divetrip);
+	return changed;
+}
+
+#undef SET
+
+void invalidate_dive_summary(int idx)
+{
+	if (idx < 0)
+		idx = 0;
+	if (idx < summary_valid)
+		summary_valid = idx;
+	summary.generation++;
+	invalidate_statistics(idx);
+}
+
+/* the values of the dive at 'idx' changed, but it didn't move */
+void update_dive_summary(int idx)
+{
+	if (idx >= 0 && idx < summary_valid && idx < dive_table.nr &&
+	    fill_row(idx, dive_table.dives[idx])) {
+		summary.generation++;
+		invalidate_statistics(idx);
+	}
+}
+
+const struct dive_summary *get_dive_summary(void)
+{
+	int i, nr = dive_table.nr;
+
+	if (nr > summary.allocated)
+		grow_dive_summary(nr);
+	if (summary_valid > nr)
+		summary_valid = nr;
+	if (summary_valid < nr || summary.nr != nr)
+		summary.generation++;
+	for (i = summary_valid; i < nr; i++)
+		fill_row(i, dive_table.dives[i]);
+	summary_valid = nr;
+	summary.nr = nr;
+	return &summary;
+}
@@ -7,6 +7,9 @@
 #include "gettext.h"
 #include <zip.h>
 #include <time.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 #include "dive.h"
 #include "file.h"
@@ -16,14 +19,66 @@
 #define O_BINARY 0
 #endif
 
+#define MAP_THRESHOLD (64 * 1024)
+
+/*
+ * Read everything up to end of file, whatever size the reads come back in.
+ * 'size' is only a hint of how big the file is, pipes and special files
+ * don't know theirs.
+ */
+static int read_fd(int fd, size_t size, struct memblock *mem)
+{
+	size_t allocated = size + 1, len = 0;
+	char *buf = malloc(allocated);
+
+	if (!buf) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (;;) {
+		ssize_t n;
+
+		if (len + 1 == allocated) {
+			char *newbuf;
+
+			allocated = allocated * 3 / 2 + 4096;
+			newbuf = realloc(buf, allocated);
+			if (!newbuf) {
+				free(buf);
+				errno = ENOMEM;
+				return -1;
+			}
+			buf = newbuf;
+		}
+		n = read(fd, buf + len, allocated - len - 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return -1;
+		}
+		if (!n)
+			break;
+		len += n;
+	}
+	if (!len) {
+		free(buf);
+		return 0;
+	}
+	buf[len] = 0;
+	mem->buffer = buf;
+	mem->size = len;
+	return len;
+}
+
 int readfile(const char *filename, struct memblock *mem)
 {
 	int ret, fd;
 	struct stat st;
-	char *buf;
 
 	mem->buffer = NULL;
 	mem->size = 0;
+	mem->mapped = 0;
 
 	fd = subsurface_open(filename, O_RDONLY | O_BINARY, 0);
 	if (fd < 0)
@@ -37,40 +92,122 @@ int readfile(const char *filename, struct memblock *mem)
 	ret = 0;
 	if (!st.st_size)
 		goto out;
-	buf = malloc(st.st_size + 1);
-	ret = -1;
-	errno = ENOMEM;
-	if (!buf)
-		goto out;
-	mem->buffer = buf;
-	mem->size = st.st_size;
-	ret = read(fd, buf, mem->size);
-	if (ret < 0)
-		goto free;
-	buf[ret] = 0;
-	if (ret == mem->size)
-		goto out;
-	errno = EIO;
-	ret = -1;
-free:
-	free(mem->buffer);
+	ret = read_fd(fd, st.st_size, mem);
+out:
+	close(fd);
+	return ret;
+}
+
+#ifndef WIN32
+/*
+ * Map the file with at least one zeroed byte after its end, so the parsers
+ * can treat it as a string like a buffer from readfile(). The tail of the
+ * last page past the end of the file reads as zeroes; when the file ends
+ * on a page boundary that byte comes from the anonymous mapping the file
+ * was mapped over. The mapping is private, so writing to it doesn't touch
+ * the file.
+ */
+static int map_fd(int fd, size_t size, struct memblock *mem)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t mapsize = (size + page) & ~(page - 1);
+	void *map;
+
+	map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	if (mmap(map, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(map, mapsize);
+		return -1;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+	mem->buffer = map;
+	mem->size = size;
+	mem->mapped = mapsize;
+	return size;
+}
+#endif
+
+/*
+ * Like readfile(), but big regular files are mapped instead of copied onto
+ * the heap, and pipes and other files that can't be mapped are read until
+ * they end. The buffer can't be realloc'ed and has to be released with
+ * free_memblock().
+ */
+int mapfile(const char *filename, struct memblock *mem)
+{
+	int ret, fd;
+	struct stat st;
+
 	mem->buffer = NULL;
 	mem->size = 0;
+	mem->mapped = 0;
+
+	fd = subsurface_open(filename, O_RDONLY | O_BINARY, 0);
+	if (fd < 0)
+		return fd;
+	ret = fstat(fd, &st);
+	if (ret < 0)
+		goto out;
+	ret = -EINVAL;
+	if (S_ISDIR(st.st_mode))
+		goto out;
+	if (!S_ISREG(st.st_mode)) {
+		ret = read_fd(fd, 0, mem);
+		goto out;
+	}
+	ret = 0;
+	if (!st.st_size)
+		goto out;
+#ifndef WIN32
+	/* small files are cheaper to just read */
+	if (st.st_size >= MAP_THRESHOLD && (ret = map_fd(fd, st.st_size, mem)) >= 0)
+		goto out;
+#endif
+	ret = read_fd(fd, st.st_size, mem);
 out:
 	close(fd);
 	return ret;
 }
 
-
-static void zip_read(struct zip_file *file, const char *filename)
+void free_memblock(struct memblock *mem)
 {
-	int size = 1024, n, read = 0;
-	char *mem = malloc(size);
+#ifndef WIN32
+	if (mem->mapped)
+		munmap(mem->buffer, mem->mapped);
+	else
+#endif
+		free(mem->buffer);
+	mem->buffer = NULL;
+	mem->size = 0;
+	mem->mapped = 0;
+}
 
-	while ((n = zip_fread(file, mem + read, size - read)) > 0) {
+static void zip_read(struct zip *zip, int index, struct zip_file *file, const char *filename)
+{
+	struct zip_stat st;
+	size_t size = 1024, read = 0;
+	bool known_size = false;
+	int n;
+	char *mem;
+
+	/* read straight into a buffer of the right size if the archive knows it */
+	if (!zip_stat_index(zip, index, 0, &st) && st.size) {
+		size = st.size + 1;
+		known_size = true;
+	}
+	mem = malloc(size);
+	if (!mem)
+		return;
+	while (read + 1 < size && (n = zip_fread(file, mem + read, size - read - 1)) > 0) {
 		read += n;
-		size = read * 3 / 2;
-		mem = realloc(mem, size);
+		if (read + 1 == size && !known_size) {
+			char *newmem = realloc(mem, size * 3 / 2);
+			if (!newmem)
+				break;
+			mem = newmem;
+			size = size * 3 / 2;
+		}
 	}
 	mem[read] = 0;
 	parse_xml_buffer(filename, mem, read, &dive_table, NULL);
@@ -89,7 +226,7 @@ static int try_to_open_zip(const char *filename, struct memblock *mem)
 			struct zip_file *file = zip_fopen_index(zip, index, 0);
 			if (!file)
 				break;
-			zip_read(file, filename);
+			zip_read(zip, index, file, filename);
 			zip_fclose(file);
 			success++;
 		}
@@ -361,7 +498,7 @@ int parse_file(const char *filename)
 	if (git && !git_load_dives(git, branch))
 		return 0;
 
-	if (readfile(filename, &mem) < 0) {
+	if (mapfile(filename, &mem) < 0) {
 		/* we don't want to display an error if this was the default file */
 		if (prefs.default_filename && !strcmp(filename, prefs.default_filename))
 			return 0;
@@ -372,13 +509,13 @@ int parse_file(const char *filename)
 	fmt = strrchr(filename, '.');
 	if (fmt && (!strcasecmp(fmt + 1, "DB") || !strcasecmp(fmt + 1, "BAK"))) {
 		if (!try_to_open_db(filename, &mem)) {
-			free(mem.buffer);
+			free_memblock(&mem);
 			return 0;
 		}
 	}
 
 	parse_file_buffer(filename, &mem);
-	free(mem.buffer);
+	free_memblock(&mem);
 	return 0;
 }
 
@@ -408,6 +545,20 @@ int parse_csv_file(const char *filename, int timef, int depthf, int tempf, int p
 	if (timef >= MAXCOLS || depthf >= MAXCOLS || tempf >= MAXCOLS || po2f >= MAXCOLS || cnsf >= MAXCOLS || ndlf >= MAXCOLS || cnsf >= MAXCOLS || stopdepthf >= MAXCOLS || pressuref >= MAXCOLS)
 		return report_error(translate("gettextFromC", "Maximum number of supported columns on CSV import is %d"), MAXCOLS);
 
+	if (filename == NULL)
+		return report_error("No CSV filename");
+
+	/* plain sample exports are read directly, the others need their stylesheet */
+	if (!strcmp(csvtemplate, "csv")) {
+		int fields[CSV_FIELDS] = { timef, depthf, tempf, po2f, cnsf, ndlf, ttsf, stopdepthf, pressuref };
+
+		if (mapfile(filename, &mem) < 0)
+			return report_error(translate("gettextFromC", "Failed to read '%s'"), filename);
+		parse_csv_buffer(filename, mem.buffer, mem.size, fields, sepidx, unitidx, &dive_table);
+		free_memblock(&mem);
+		return 0;
+	}
+
 	snprintf(timebuf, MAXCOLDIGITS, "%d", timef);
 	snprintf(depthbuf, MAXCOLDIGITS, "%d", depthf);
 	snprintf(tempbuf, MAXCOLDIGITS, "%d", tempf);
@@ -455,9 +606,6 @@ int parse_csv_file(const char *filename, int timef, int depthf, int tempf, int p
 	params[pnr++] = separator_index;
 	params[pnr++] = NULL;
 
-	if (filename == NULL)
-		return report_error("No CSV filename");
-
 	if (try_to_xslt_open_csv(filename, &mem, csvtemplate))
 		return -1;
 
@@ -4,6 +4,7 @@
 struct memblock {
 	void *buffer;
 	size_t size;
+	size_t mapped;	/* length of the mapping, 0 if malloc'ed */
 };
 
 #if 0
@@ -14,6 +15,8 @@ extern int try_to_open_cochran(const char *filename, struct memblock *mem, GErro
 extern "C" {
 #endif
 extern int readfile(const char *filename, struct memblock *mem);
+extern int mapfile(const char *filename, struct memblock *mem);
+extern void free_memblock(struct memblock *mem);
 extern timestamp_t parse_date(const char *date);
 #ifdef __cplusplus
 }
@@ -36,6 +36,8 @@ QString uiLanguage(QLocale *callerLoc);
 QLocale getLocale();
 QString getDateFormat();
 void selectedDivesGasUsed(QVector<QPair<QString, int> > &gasUsed);
+void selectedDivesGasParts(volume_t *o2_tot, volume_t *he_tot);
+void processSelectedDives();
 
 #if defined __APPLE__
 #define TITLE_OR_TEXT(_t, _m) "", _t + "\n" + _m
@@ -337,17 +337,25 @@ static int match_one_dive(struct divecomputer *a, struct dive *dive)
 
 /*
  * Check if this dive already existed before the import
+ *
+ * Any dive that could match has a dive computer with the same
+ * device and dive id or the same start time, so only those dives
+ * from the dc index need to be looked at.
  */
 static int find_dive(struct divecomputer *match)
 {
-	int i;
-
-	for (i = 0; i < dive_table.preexisting; i++) {
-		struct dive *old = dive_table.dives[i];
-
+	int pos = -1;
+	struct dive *old;
+
+	if (match->diveid) {
+		while ((old = dc_index_next_by_id(match->deviceid, match->diveid, &pos)) != NULL)
+			if (match_one_dive(match, old))
+				return 1;
+		pos = -1;
+	}
+	while ((old = dc_index_next_by_when(match->when, &pos)) != NULL)
 		if (match_one_dive(match, old))
 			return 1;
-	}
 	return 0;
 }
 
@@ -779,7 +787,9 @@ const char *do_libdivecomputer_import(device_data_t *data)
 	err = translate("gettextFromC", "Unable to open %s %s (%s)");
 	rc = dc_device_open(&data->device, data->context, data->descriptor, data->devname);
 	if (rc == DC_STATUS_SUCCESS) {
+		build_dc_index(dive_table.preexisting);
 		err = do_device_import(data);
+		free_dc_index();
 		/* TODO: Show the logfile to the user on error. */
 		dc_device_close(data->device);
 	}
@@ -46,50 +46,58 @@ static char *get_utf8(struct membuffer *b)
 	return res;
 }
 
+/* location, buddy and equipment names are shared by lots of dives */
+static char *get_interned_utf8(struct membuffer *b)
+{
+	if (!b->len)
+		return NULL;
+	return intern_string(mb_cstring(b));
+}
+
 static temperature_t get_temperature(const char *line)
 {
 	temperature_t t;
-	t.mkelvin = C_to_mkelvin(ascii_strtod(line, NULL));
+	t.mkelvin = strtol_scaled(line, NULL, 3) + ZERO_C_IN_MKELVIN;
 	return t;
 }
 
 static depth_t get_depth(const char *line)
 {
 	depth_t d;
-	d.mm = rint(1000*ascii_strtod(line, NULL));
+	d.mm = strtol_scaled(line, NULL, 3);
 	return d;
 }
 
 static volume_t get_volume(const char *line)
 {
 	volume_t v;
-	v.mliter = rint(1000*ascii_strtod(line, NULL));
+	v.mliter = strtol_scaled(line, NULL, 3);
 	return v;
 }
 
 static weight_t get_weight(const char *line)
 {
 	weight_t w;
-	w.grams = rint(1000*ascii_strtod(line, NULL));
+	w.grams = strtol_scaled(line, NULL, 3);
 	return w;
 }
 
 static pressure_t get_pressure(const char *line)
 {
 	pressure_t p;
-	p.mbar = rint(1000*ascii_strtod(line, NULL));
+	p.mbar = strtol_scaled(line, NULL, 3);
 	return p;
 }
 
 static int get_salinity(const char *line)
 {
-	return rint(10*ascii_strtod(line, NULL));
+	return strtol_scaled(line, NULL, 1);
 }
 
 static fraction_t get_fraction(const char *line)
 {
 	fraction_t f;
-	f.permille = rint(10*ascii_strtod(line, NULL));
+	f.permille = strtol_scaled(line, NULL, 1);
 	return f;
 }
 
@@ -123,10 +131,8 @@ static void update_time(timestamp_t *when, const char *line)
 
 static duration_t get_duration(const char *line)
 {
-	int m = 0, s = 0;
 	duration_t d;
-	sscanf(line, "%d:%d", &m, &s);
-	d.seconds = m*60+s;
+	d.seconds = strtoseconds(line, NULL);
 	return d;
 }
 
@@ -136,16 +142,16 @@ static int get_hex(const char *line)
 { return strtoul(line, NULL, 16); }
 
 static void parse_dive_location(char *line, struct membuffer *str, void *_dive)
-{ struct dive *dive = _dive; dive->location = get_utf8(str); }
+{ struct dive *dive = _dive; dive->location = get_interned_utf8(str); }
 
 static void parse_dive_divemaster(char *line, struct membuffer *str, void *_dive)
-{ struct dive *dive = _dive; dive->divemaster = get_utf8(str); }
+{ struct dive *dive = _dive; dive->divemaster = get_interned_utf8(str); }
 
 static void parse_dive_buddy(char *line, struct membuffer *str, void *_dive)
-{ struct dive *dive = _dive; dive->buddy = get_utf8(str); }
+{ struct dive *dive = _dive; dive->buddy = get_interned_utf8(str); }
 
 static void parse_dive_suit(char *line, struct membuffer *str, void *_dive)
-{ struct dive *dive = _dive; dive->suit = get_utf8(str); }
+{ struct dive *dive = _dive; dive->suit = get_interned_utf8(str); }
 
 static void parse_dive_notes(char *line, struct membuffer *str, void *_dive)
 { struct dive *dive = _dive; dive->notes = get_utf8(str); }
@@ -263,7 +269,7 @@ static void parse_dive_cylinder(char *line, struct membuffer *str, void *_dive)
 	cylinder_t *cylinder = dive->cylinder + cylinder_index;
 
 	cylinder_index++;
-	cylinder->type.description = get_utf8(str);
+	cylinder->type.description = get_interned_utf8(str);
 	for (;;) {
 		char c;
 		while (isspace(c = *line))
@@ -293,7 +299,7 @@ static void parse_dive_weightsystem(char *line, struct membuffer *str, void *_di
 	weightsystem_t *ws = dive->weightsystem + weightsystem_index;
 
 	weightsystem_index++;
-	ws->description = get_utf8(str);
+	ws->description = get_interned_utf8(str);
 	for (;;) {
 		char c;
 		while (isspace(c = *line))
@@ -393,7 +399,7 @@ static void parse_sample_keyvalue(void *_sample, const char *key, const char *va
 	report_error("Unexpected sample key/value pair (%s/%s)", key, value);
 }
 
-static char *parse_sample_unit(struct sample *sample, double val, char *unit)
+static char *parse_sample_unit(struct sample *sample, long val, char *unit)
 {
 	char *end = unit, c;
 
@@ -409,13 +415,13 @@ static char *parse_sample_unit(struct sample *sample, double val, char *unit)
 	/* The units are "°C", "m" or "bar", so let's just look at the first character */
 	switch (*unit) {
 	case 'm':
-		sample->depth.mm = rint(1000*val);
+		sample->depth.mm = val;
 		break;
 	case 'b':
-		sample->cylinderpressure.mbar = rint(1000*val);
+		sample->cylinderpressure.mbar = val;
 		break;
 	default:
-		sample->temperature.mkelvin = C_to_mkelvin(val);
+		sample->temperature.mkelvin = val + ZERO_C_IN_MKELVIN;
 		break;
 	}
 
@@ -445,13 +451,11 @@ static struct sample *new_sample(struct divecomputer *dc)
 
 static void sample_parser(char *line, struct divecomputer *dc)
 {
-	int m, s = 0;
+	const char *end;
 	struct sample *sample = new_sample(dc);
 
-	m = strtol(line, &line, 10);
-	if (*line == ':')
-		s = strtol(line+1, &line, 10);
-	sample->time.seconds = m*60+s;
+	sample->time.seconds = strtoseconds(line, &end);
+	line = (char *)end;
 
 	for (;;) {
 		char c;
@@ -464,8 +468,8 @@ static void sample_parser(char *line, struct divecomputer *dc)
 		if (c >= 'a' && c <= 'z') {
 			line = parse_keyvalue_entry(parse_sample_keyvalue, sample, line);
 		} else {
-			const char *end;
-			double val = ascii_strtod(line, &end);
+			/* all the units have three decimals */
+			long val = strtol_scaled(line, &end, 3);
 			if (end == line) {
 				report_error("Odd sample data: %s", line);
 				break;
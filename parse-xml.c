@@ -10,6 +10,8 @@
 #include <libxml/parser.h>
 #include <libxml/parserInternals.h>
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
+#include <libxml/xpath.h>
 #include <libxslt/transform.h>
 #include <libdivecomputer/parser.h>
 
@@ -17,11 +19,13 @@
 
 #include "dive.h"
 #include "device.h"
+#include "membuffer.h"
 
 int verbose, quit;
 int metric = 1;
 
 static xmlDoc *test_xslt_transforms(xmlDoc *doc, const char **params);
+static bool has_xslt_transform(const char *root);
 
 /* the dive table holds the overall dive list; target table points at
  * the table we are currently filling */
@@ -31,7 +35,7 @@ struct dive_table *target_table = NULL;
 /*
  * Add a dive into the dive_table array
  */
-static void record_dive_to_table(struct dive *dive, struct dive_table *table)
+static void add_dive_to_table(struct dive *dive, struct dive_table *table)
 {
 	assert(table != NULL);
 	int nr = table->nr, allocated = table->allocated;
@@ -45,8 +49,18 @@ static void record_dive_to_table(struct dive *dive, struct dive_table *table)
 		table->dives = dives;
 		table->allocated = allocated;
 	}
-	dives[nr] = fixup_dive(dive);
+	dives[nr] = dive;
 	table->nr = nr + 1;
+	if (table == &dive_table) {
+		dive_id_index_add(nr);
+		invalidate_oxygen_exposure(nr);
+		invalidate_dive_summary(nr);
+	}
+}
+
+static void record_dive_to_table(struct dive *dive, struct dive_table *table)
+{
+	add_dive_to_table(fixup_dive(dive), table);
 }
 
 void record_dive(struct dive *dive)
@@ -87,6 +101,60 @@ static int match(const char *pattern, int plen,
 	return 1;
 }
 
+/*
+ * For the names that show up for every sample: instead of trying one
+ * pattern after the other, the first part of the name is looked up in
+ * a small hash table of the names we know, which gives an index to
+ * switch() on.
+ */
+struct name_index {
+	unsigned int size;
+	short *slots;		/* 1 + index into the names, 0 for empty */
+};
+
+static unsigned int name_hash(const char *name, int len)
+{
+	unsigned int h = 2166136261u;
+
+	while (len--)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	return h;
+}
+
+static void build_name_index(struct name_index *index, const char *const names[], int nr)
+{
+	int i;
+
+	for (index->size = 16; index->size < 4 * nr; index->size *= 2)
+		;
+	index->slots = calloc(index->size, sizeof(short));
+	if (!index->slots)
+		exit(1);
+	for (i = 0; i < nr; i++) {
+		unsigned int slot = name_hash(names[i], strlen(names[i])) & (index->size - 1);
+		while (index->slots[slot])
+			slot = (slot + 1) & (index->size - 1);
+		index->slots[slot] = i + 1;
+	}
+}
+
+/* the index of the first component of 'name' in 'names', or -1 */
+static int lookup_name(struct name_index *index, const char *const names[], int nr, const char *name)
+{
+	int len = strcspn(name, ".");
+	unsigned int slot;
+
+	if (!index->slots)
+		build_name_index(index, names, nr);
+	slot = name_hash(name, len) & (index->size - 1);
+	for (; index->slots[slot]; slot = (slot + 1) & (index->size - 1)) {
+		const char *candidate = names[index->slots[slot] - 1];
+		if (!strncmp(candidate, name, len) && !candidate[len])
+			return index->slots[slot] - 1;
+	}
+	return -1;
+}
+
 
 struct units xml_parsing_units;
 const struct units SI_units = SI_UNITS;
@@ -98,6 +166,13 @@ const struct units IMPERIAL_units = IMPERIAL_UNITS;
 static struct divecomputer *cur_dc;
 static struct dive *cur_dive;
 static dive_trip_t *cur_trip = NULL;
+
+/* trips that are only inserted once the whole file has been parsed */
+static struct {
+	bool active;
+	int nr, allocated;
+	dive_trip_t **trips;
+} deferred_trips;
 static struct sample *cur_sample;
 static struct picture *cur_picture;
 static struct {
@@ -281,38 +356,59 @@ static enum number_type integer_or_float(char *buffer, union int_or_float *res)
 	return parse_float(buffer, &res->fp, &end);
 }
 
+/*
+ * Like parse_float(), but into an integer scaled by 10^decimals without
+ * going through a double, which is what the metric values end up as.
+ */
+static enum number_type parse_scaled(const char *buffer, int decimals, long *res)
+{
+	const char *end;
+	double val;
+
+	*res = strtol_scaled(buffer, &end, decimals);
+	if (end == buffer)
+		return NEITHER;
+	if (*end == ',') {
+		/* leave decimal commas to parse_float() */
+		if (parse_float(buffer, &val, &end) == NEITHER)
+			return NEITHER;
+		while (decimals-- > 0)
+			val *= 10;
+		*res = lrint(val);
+	}
+	return FLOAT;
+}
+
 static void pressure(char *buffer, pressure_t *pressure)
 {
 	double mbar = 0.0;
 	union int_or_float val;
+	long scaled;
 
-	switch (integer_or_float(buffer, &val)) {
-	case FLOAT:
+	if (xml_parsing_units.pressure == BAR) {
+		if (parse_scaled(buffer, 3, &scaled) == NEITHER)
+			goto strange;
 		/* Just ignore zero values */
+		if (!scaled)
+			return;
+		/* Assume mbar, but if it's really small, it's bar */
+		mbar = labs(scaled) < 5000000 ? scaled : scaled / 1000.0;
+	} else {
+		if (integer_or_float(buffer, &val) == NEITHER)
+			goto strange;
 		if (!val.fp)
-			break;
-		switch (xml_parsing_units.pressure) {
-		case PASCAL:
+			return;
+		if (xml_parsing_units.pressure == PASCAL)
 			mbar = val.fp / 100;
-			break;
-		case BAR:
-			/* Assume mbar, but if it's really small, it's bar */
-			mbar = val.fp;
-			if (fabs(mbar) < 5000)
-				mbar = mbar * 1000;
-			break;
-		case PSI:
+		else
 			mbar = psi_to_mbar(val.fp);
-			break;
-		}
-		if (fabs(mbar) > 5 && fabs(mbar) < 5000000) {
-			pressure->mbar = rint(mbar);
-			break;
-		}
-	/* fallthrough */
-	default:
-		printf("Strange pressure reading %s\n", buffer);
 	}
+	if (fabs(mbar) > 5 && fabs(mbar) < 5000000) {
+		pressure->mbar = rint(mbar);
+		return;
+	}
+strange:
+	printf("Strange pressure reading %s\n", buffer);
 }
 
 static void salinity(char *buffer, int *salinity)
@@ -330,6 +426,15 @@ static void salinity(char *buffer, int *salinity)
 static void depth(char *buffer, depth_t *depth)
 {
 	union int_or_float val;
+	long mm;
+
+	if (xml_parsing_units.length == METERS) {
+		if (parse_scaled(buffer, 3, &mm) == FLOAT)
+			depth->mm = mm;
+		else
+			printf("Strange depth reading %s\n", buffer);
+		return;
+	}
 
 	switch (integer_or_float(buffer, &val)) {
 	case FLOAT:
@@ -370,21 +475,23 @@ static void weight(char *buffer, weight_t *weight)
 static void temperature(char *buffer, temperature_t *temperature)
 {
 	union int_or_float val;
-
-	switch (integer_or_float(buffer, &val)) {
-	case FLOAT:
-		switch (xml_parsing_units.temperature) {
-		case KELVIN:
-			temperature->mkelvin = val.fp * 1000;
-			break;
-		case CELSIUS:
-			temperature->mkelvin = C_to_mkelvin(val.fp);
-			break;
-		case FAHRENHEIT:
-			temperature->mkelvin = F_to_mkelvin(val.fp);
-			break;
-		}
+	long mkelvin;
+
+	switch (xml_parsing_units.temperature) {
+	case KELVIN:
+	case CELSIUS:
+		if (parse_scaled(buffer, 3, &mkelvin) == NEITHER)
+			goto strange;
+		if (xml_parsing_units.temperature == CELSIUS)
+			mkelvin += ZERO_C_IN_MKELVIN;
+		temperature->mkelvin = mkelvin;
+		break;
+	case FAHRENHEIT:
+		if (integer_or_float(buffer, &val) == NEITHER)
+			goto strange;
+		temperature->mkelvin = F_to_mkelvin(val.fp);
 		break;
+	strange:
 	default:
 		printf("Strange temperature reading %s\n", buffer);
 	}
@@ -396,21 +503,13 @@ static void temperature(char *buffer, temperature_t *temperature)
 
 static void sampletime(char *buffer, duration_t *time)
 {
-	int i;
-	int min, sec;
+	const char *end;
+	int seconds = strtoseconds(buffer, &end);
 
-	i = sscanf(buffer, "%d:%d", &min, &sec);
-	switch (i) {
-	case 1:
-		sec = min;
-		min = 0;
-	/* fallthrough */
-	case 2:
-		time->seconds = sec + min * 60;
-		break;
-	default:
+	if (end == buffer)
 		printf("Strange sample time reading %s\n", buffer);
-	}
+	else
+		time->seconds = seconds;
 }
 
 static void offsettime(char *buffer, offset_t *time)
@@ -527,6 +626,14 @@ static void utf8_string(char *buffer, void *_res)
 		*res = strdup(buffer);
 }
 
+/* Same for the strings lots of dives share, like locations and buddies */
+static void interned_string(char *buffer, void *_res)
+{
+	char **res = _res;
+	if (trimspace(buffer))
+		*res = intern_string(buffer);
+}
+
 /* Extract the dive computer type from the xml text buffer */
 static void get_dc_type(char *buffer, enum dive_comp_type *i)
 {
@@ -826,51 +933,106 @@ static void try_to_fill_dc(struct divecomputer *dc, const char *name, char *buf)
 }
 
 /* We're in samples - try to convert the random xml value to something useful */
+enum sample_name {
+	SN_PRESSURE, SN_CYLPRESS, SN_PDILUENT, SN_CYLINDERINDEX, SN_SENSOR, SN_DEPTH,
+	SN_TEMP, SN_TEMPERATURE, SN_SAMPLETIME, SN_TIME, SN_NDL, SN_TTS, SN_IN_DECO,
+	SN_STOPTIME, SN_STOPDEPTH, SN_CNS, SN_PO2, SN_HEARTBEAT, SN_BEARING,
+	SAMPLE_NAMES
+};
+
+static const char *const sample_names[SAMPLE_NAMES] = {
+	"pressure", "cylpress", "pdiluent", "cylinderindex", "sensor", "depth",
+	"temp", "temperature", "sampletime", "time", "ndl", "tts", "in_deco",
+	"stoptime", "stopdepth", "cns", "po2", "heartbeat", "bearing"
+};
+
+static struct name_index sample_name_index;
+
 static void try_to_fill_sample(struct sample *sample, const char *name, char *buf)
 {
 	int in_deco;
 
 	start_match("sample", name, buf);
-	if (MATCH("pressure.sample", pressure, &sample->cylinderpressure))
-		return;
-	if (MATCH("cylpress.sample", pressure, &sample->cylinderpressure))
-		return;
-	if (MATCH("pdiluent.sample", pressure, &sample->diluentpressure))
-		return;
-	if (MATCH("cylinderindex.sample", get_cylinderindex, &sample->sensor))
-		return;
-	if (MATCH("sensor.sample", get_sensor, &sample->sensor))
-		return;
-	if (MATCH("depth.sample", depth, &sample->depth))
-		return;
-	if (MATCH("temp.sample", temperature, &sample->temperature))
-		return;
-	if (MATCH("temperature.sample", temperature, &sample->temperature))
-		return;
-	if (MATCH("sampletime.sample", sampletime, &sample->time))
-		return;
-	if (MATCH("time.sample", sampletime, &sample->time))
-		return;
-	if (MATCH("ndl.sample", sampletime, &sample->ndl))
-		return;
-	if (MATCH("tts.sample", sampletime, &sample->tts))
-		return;
-	if (MATCH("in_deco.sample", get_index, &in_deco)) {
-		sample->in_deco = (in_deco == 1);
-		return;
+	switch (lookup_name(&sample_name_index, sample_names, SAMPLE_NAMES, name)) {
+	case SN_PRESSURE:
+		if (MATCH("pressure.sample", pressure, &sample->cylinderpressure))
+			return;
+		break;
+	case SN_CYLPRESS:
+		if (MATCH("cylpress.sample", pressure, &sample->cylinderpressure))
+			return;
+		break;
+	case SN_PDILUENT:
+		if (MATCH("pdiluent.sample", pressure, &sample->diluentpressure))
+			return;
+		break;
+	case SN_CYLINDERINDEX:
+		if (MATCH("cylinderindex.sample", get_cylinderindex, &sample->sensor))
+			return;
+		break;
+	case SN_SENSOR:
+		if (MATCH("sensor.sample", get_sensor, &sample->sensor))
+			return;
+		break;
+	case SN_DEPTH:
+		if (MATCH("depth.sample", depth, &sample->depth))
+			return;
+		break;
+	case SN_TEMP:
+		if (MATCH("temp.sample", temperature, &sample->temperature))
+			return;
+		break;
+	case SN_TEMPERATURE:
+		if (MATCH("temperature.sample", temperature, &sample->temperature))
+			return;
+		break;
+	case SN_SAMPLETIME:
+		if (MATCH("sampletime.sample", sampletime, &sample->time))
+			return;
+		break;
+	case SN_TIME:
+		if (MATCH("time.sample", sampletime, &sample->time))
+			return;
+		break;
+	case SN_NDL:
+		if (MATCH("ndl.sample", sampletime, &sample->ndl))
+			return;
+		break;
+	case SN_TTS:
+		if (MATCH("tts.sample", sampletime, &sample->tts))
+			return;
+		break;
+	case SN_IN_DECO:
+		if (MATCH("in_deco.sample", get_index, &in_deco)) {
+			sample->in_deco = (in_deco == 1);
+			return;
+		}
+		break;
+	case SN_STOPTIME:
+		if (MATCH("stoptime.sample", sampletime, &sample->stoptime))
+			return;
+		break;
+	case SN_STOPDEPTH:
+		if (MATCH("stopdepth.sample", depth, &sample->stopdepth))
+			return;
+		break;
+	case SN_CNS:
+		if (MATCH("cns.sample", get_uint8, &sample->cns))
+			return;
+		break;
+	case SN_PO2:
+		if (MATCH("po2.sample", double_to_o2pressure, &sample->po2))
+			return;
+		break;
+	case SN_HEARTBEAT:
+		if (MATCH("heartbeat", get_uint8, &sample->heartbeat))
+			return;
+		break;
+	case SN_BEARING:
+		if (MATCH("bearing", get_bearing, &sample->bearing))
+			return;
+		break;
 	}
-	if (MATCH("stoptime.sample", sampletime, &sample->stoptime))
-		return;
-	if (MATCH("stopdepth.sample", depth, &sample->stopdepth))
-		return;
-	if (MATCH("cns.sample", get_uint8, &sample->cns))
-		return;
-	if (MATCH("po2.sample", double_to_o2pressure, &sample->po2))
-		return;
-	if (MATCH("heartbeat", get_uint8, &sample->heartbeat))
-		return;
-	if (MATCH("bearing", get_bearing, &sample->bearing))
-		return;
 
 	switch (import_source) {
 	case DIVINGLOG:
@@ -926,13 +1088,13 @@ static int divinglog_dive_match(struct dive *dive, const char *name, char *buf)
 	       MATCH("divetime", duration, &dive->dc.duration) ||
 	       MATCH("depth", depth, &dive->dc.maxdepth) ||
 	       MATCH("depthavg", depth, &dive->dc.meandepth) ||
-	       MATCH("tanktype", utf8_string, &dive->cylinder[0].type.description) ||
+	       MATCH("tanktype", interned_string, &dive->cylinder[0].type.description) ||
 	       MATCH("tanksize", cylindersize, &dive->cylinder[0].type.size) ||
 	       MATCH("presw", pressure, &dive->cylinder[0].type.workingpressure) ||
 	       MATCH("press", pressure, &dive->cylinder[0].start) ||
 	       MATCH("prese", pressure, &dive->cylinder[0].end) ||
 	       MATCH("comments", utf8_string, &dive->notes) ||
-	       MATCH("names.buddy", utf8_string, &dive->buddy) ||
+	       MATCH("names.buddy", interned_string, &dive->buddy) ||
 	       MATCH("name.country", utf8_string, &country) ||
 	       MATCH("name.city", utf8_string, &city) ||
 	       MATCH("name.place", divinglog_place, &dive->location) ||
@@ -1149,19 +1311,19 @@ static void try_to_fill_dive(struct dive *dive, const char *name, char *buf)
 		return;
 	if (MATCH("lon", gps_long, dive))
 		return;
-	if (MATCH("location", utf8_string, &dive->location))
+	if (MATCH("location", interned_string, &dive->location))
 		return;
-	if (MATCH("name.dive", utf8_string, &dive->location))
+	if (MATCH("name.dive", interned_string, &dive->location))
 		return;
-	if (MATCH("suit", utf8_string, &dive->suit))
+	if (MATCH("suit", interned_string, &dive->suit))
 		return;
-	if (MATCH("divesuit", utf8_string, &dive->suit))
+	if (MATCH("divesuit", interned_string, &dive->suit))
 		return;
 	if (MATCH("notes", utf8_string, &dive->notes))
 		return;
-	if (MATCH("divemaster", utf8_string, &dive->divemaster))
+	if (MATCH("divemaster", interned_string, &dive->divemaster))
 		return;
-	if (MATCH("buddy", utf8_string, &dive->buddy))
+	if (MATCH("buddy", interned_string, &dive->buddy))
 		return;
 	if (MATCH("rating.dive", get_rating, &dive->rating))
 		return;
@@ -1171,13 +1333,13 @@ static void try_to_fill_dive(struct dive *dive, const char *name, char *buf)
 		return;
 	if (MATCH("workpressure.cylinder", pressure, &dive->cylinder[cur_cylinder_index].type.workingpressure))
 		return;
-	if (MATCH("description.cylinder", utf8_string, &dive->cylinder[cur_cylinder_index].type.description))
+	if (MATCH("description.cylinder", interned_string, &dive->cylinder[cur_cylinder_index].type.description))
 		return;
 	if (MATCH("start.cylinder", pressure, &dive->cylinder[cur_cylinder_index].start))
 		return;
 	if (MATCH("end.cylinder", pressure, &dive->cylinder[cur_cylinder_index].end))
 		return;
-	if (MATCH("description.weightsystem", utf8_string, &dive->weightsystem[cur_ws_index].description))
+	if (MATCH("description.weightsystem", interned_string, &dive->weightsystem[cur_ws_index].description))
 		return;
 	if (MATCH("weight.weightsystem", weight, &dive->weightsystem[cur_ws_index].weight))
 		return;
@@ -1317,7 +1479,17 @@ static void trip_end(void)
 {
 	if (!cur_trip)
 		return;
-	insert_trip(&cur_trip);
+	if (deferred_trips.active) {
+		if (deferred_trips.nr == deferred_trips.allocated) {
+			deferred_trips.allocated = (deferred_trips.nr + 8) * 2;
+			deferred_trips.trips = realloc(deferred_trips.trips, deferred_trips.allocated * sizeof(dive_trip_t *));
+			if (!deferred_trips.trips)
+				exit(1);
+		}
+		deferred_trips.trips[deferred_trips.nr++] = cur_trip;
+	} else {
+		insert_trip(&cur_trip);
+	}
 	cur_trip = NULL;
 }
 
@@ -1614,24 +1786,62 @@ static struct nesting {
 	  { NULL, }
   };
 
+/*
+ * The element names come out of the dictionary of the libxml2 parser, so
+ * within one document the same name is the same pointer and the rule for
+ * it can be remembered by address. reset_all() forgets them for the next
+ * document.
+ */
+#define NESTING_CACHE 64
+
+static struct {
+	const char *name;
+	struct nesting *rule;
+} nesting_cache[NESTING_CACHE];
+
+static struct nesting *lookup_nesting(const char *name)
+{
+	struct nesting *rule = nesting;
+
+	do {
+		if (!strcmp(rule->name, name))
+			break;
+		rule++;
+	} while (rule->name);
+	return rule;
+}
+
+static struct nesting *find_nesting(const char *name)
+{
+	unsigned int slot = ((uintptr_t)name >> 3) % NESTING_CACHE;
+	struct nesting *rule;
+
+	if (nesting_cache[slot].name == name)
+		return nesting_cache[slot].rule;
+	rule = lookup_nesting(name);
+	nesting_cache[slot].name = name;
+	nesting_cache[slot].rule = rule;
+	return rule;
+}
+
+static void reset_nesting_cache(void)
+{
+	memset(nesting_cache, 0, sizeof(nesting_cache));
+}
+
 static void traverse(xmlNode *root)
 {
 	xmlNode *n;
 
 	for (n = root; n; n = n->next) {
-		struct nesting *rule = nesting;
+		struct nesting *rule;
 
 		if (!n->name) {
 			visit(n);
 			continue;
 		}
 
-		do {
-			if (!strcmp(rule->name, n->name))
-				break;
-			rule++;
-		} while (rule->name);
-
+		rule = find_nesting(n->name);
 		if (rule->start)
 			rule->start();
 		visit(n);
@@ -1652,6 +1862,7 @@ static void reset_all(void)
 	 */
 	xml_parsing_units = SI_units;
 	import_source = UNKNOWN;
+	reset_nesting_cache();
 }
 
 /* divelog.de sends us xml files that claim to be iso-8859-1
@@ -1679,6 +1890,465 @@ const char *preprocess_divelog_de(const char *buffer)
 	return buffer;
 }
 
+/*
+ * Files in our own format are parsed as a stream, without building the
+ * document tree: that would be many times the size of the file, on top
+ * of the file itself and the dives we make of it. The walk below hands
+ * entry() the same "node.parent" names the tree walk does, and calls the
+ * same nesting rules.
+ */
+#define MAX_NESTING 64
+
+struct stream_element {
+	char name[MAXNAME];
+	struct nesting *rule;
+};
+
+static void lowercase_name(char *buf, const char *name)
+{
+	int len;
+
+	for (len = 0; name[len] && len < MAXNAME - 1; len++)
+		buf[len] = (name[len] >= 'A' && name[len] <= 'Z') ? name[len] - 'A' + 'a' : name[len];
+	buf[len] = 0;
+}
+
+static bool is_blank(const char *text)
+{
+	while (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r')
+		text++;
+	return !*text;
+}
+
+static void stream_entry(const char *node, const char *parent, char *value)
+{
+	static char buffer[2 * MAXNAME];
+
+	if (!value || is_blank(value))
+		return;
+	if (parent)
+		snprintf(buffer, sizeof(buffer), "%s.%s", node, parent);
+	else
+		snprintf(buffer, sizeof(buffer), "%s", node);
+	entry(buffer, value);
+}
+
+static void stream_element_start(xmlTextReaderPtr reader, struct stream_element *e)
+{
+	char name[MAXNAME];
+	char *value;
+
+	e->rule = find_nesting(xmlTextReaderConstLocalName(reader));
+	lowercase_name(e->name, xmlTextReaderConstLocalName(reader));
+	if (e->rule->start)
+		e->rule->start();
+	while (xmlTextReaderMoveToNextAttribute(reader) == 1) {
+		if (xmlTextReaderIsNamespaceDecl(reader))
+			continue;
+		lowercase_name(name, xmlTextReaderConstLocalName(reader));
+		value = xmlTextReaderValue(reader);
+		stream_entry(name, e->name, value);
+		xmlFree(value);
+	}
+	xmlTextReaderMoveToElement(reader);
+}
+
+static void stream_element_end(struct stream_element *e)
+{
+	if (e->rule->end)
+		e->rule->end();
+}
+
+/* the reader is on the root element; returns false on a parse error */
+static bool stream_traverse(xmlTextReaderPtr reader)
+{
+	struct stream_element stack[MAX_NESTING];
+	int depth = 0, ret;
+	char *value;
+
+	do {
+		switch (xmlTextReaderNodeType(reader)) {
+		case XML_READER_TYPE_ELEMENT: {
+			bool empty = xmlTextReaderIsEmptyElement(reader);
+
+			if (depth == MAX_NESTING) {
+				ret = -1;
+				goto out;
+			}
+			stream_element_start(reader, stack + depth);
+			depth++;
+			/* <element/> doesn't get an end tag */
+			if (empty)
+				stream_element_end(stack + --depth);
+			break;
+		}
+		case XML_READER_TYPE_END_ELEMENT:
+			if (depth)
+				stream_element_end(stack + --depth);
+			break;
+		case XML_READER_TYPE_TEXT:
+		case XML_READER_TYPE_CDATA:
+			if (!depth)
+				break;
+			value = xmlTextReaderValue(reader);
+			stream_entry(stack[depth - 1].name, depth > 1 ? stack[depth - 2].name : NULL, value);
+			xmlFree(value);
+			break;
+		}
+	} while ((ret = xmlTextReaderRead(reader)) == 1);
+out:
+	/* don't leave a half-read sample or dive computer behind */
+	while (depth)
+		stream_element_end(stack + --depth);
+	return ret == 0;
+}
+
+static bool next_element(xmlTextReaderPtr reader)
+{
+	while (xmlTextReaderRead(reader) == 1)
+		if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT)
+			return true;
+	return false;
+}
+
+/*
+ * Does the file need no stylesheet? Looks at the first two elements the
+ * same way test_xslt_transforms() does, anything it isn't sure about is
+ * left to the tree walk.
+ */
+static bool is_native_xml(const char *url, const char *buffer)
+{
+	xmlTextReaderPtr reader = xmlReaderForMemory(buffer, strlen(buffer), url, NULL, 0);
+	bool native = false;
+
+	if (!reader)
+		return false;
+	if (next_element(reader)) {
+		if (!has_xslt_transform(xmlTextReaderConstLocalName(reader))) {
+			native = true;
+		} else if (next_element(reader)) {
+			char *name = xmlTextReaderGetAttribute(reader, "name");
+			native = name && !strcasecmp(name, "subsurface");
+			xmlFree(name);
+		}
+	}
+	xmlFreeTextReader(reader);
+	return native;
+}
+
+static void parse_xml_stream(const char *url, const char *buffer)
+{
+	xmlTextReaderPtr reader = xmlReaderForMemory(buffer, strlen(buffer), url, NULL, 0);
+
+	if (!reader || !next_element(reader)) {
+		report_error(translate("gettextFromC", "Failed to parse '%s'"), url);
+		xmlFreeTextReader(reader);
+		return;
+	}
+	set_save_userid_local(false);
+	set_userid("");
+	reset_all();
+	dive_start();
+	if (!stream_traverse(reader))
+		report_error(translate("gettextFromC", "Failed to parse '%s'"), url);
+	dive_end();
+	xmlFreeTextReader(reader);
+}
+
+#ifdef PARALLEL_XML_PARSE
+/*
+ * Most of the time spent loading a big file is libxml2 taking the text
+ * apart. So on machines with enough cores, big files in our own format
+ * are cut between the dives and trips at the top level. Each piece is
+ * wrapped into the elements that enclose the dives, and is parsed into a
+ * tree on the thread pool. The trees are then walked one after the other
+ * on this thread, by the same code and in the same order as a single tree
+ * would be. Building the dives touches the string pool, the tag list and
+ * other shared state, so that part stays here.
+ *
+ * Building the trees takes about as long as streaming the whole file,
+ * and walking them adds another third or so on this thread. That only
+ * pays off with three or more cores to build the trees on, hence
+ * PARSE_MIN_THREADS.
+ * The trees are walked a batch at a time, so only a few of them exist at
+ * any time, but the dives and trips are kept aside until all pieces have
+ * parsed. If one of them doesn't, they are thrown away again and the file
+ * is handed to the stream parser as a whole, instead of recording the
+ * dives around the broken piece.
+ *
+ * This needs about twice the memory of the stream parser (226MB against
+ * 104MB for a 50MB file), and the speedup has not been measured on a
+ * machine with enough cores yet. So it's only built when asked for with
+ * PARALLEL_XML_PARSE, and the stream parser stays the default.
+ */
+#define PARSE_CHUNK_SIZE (256 * 1024)
+#define PARSE_BATCH 16
+#define PARSE_MIN_THREADS 4
+#define MAX_WRAPPERS 8
+
+struct xml_chunk {
+	const char *url;
+	struct membuffer text;
+	xmlDoc *doc;
+};
+
+struct xml_layout {
+	char *prolog;			/* the <?xml ...?> declaration, if any */
+	struct membuffer open, close;	/* the elements around the dives */
+	int nr, allocated;
+	int *cut;			/* where the pieces start */
+};
+
+static bool is_split_element(const char *name, int len)
+{
+	return (len == 4 && !strncmp(name, "dive", 4)) || (len == 4 && !strncmp(name, "trip", 4));
+}
+
+/* the '>' that ends the tag at 'p', skipping quoted attribute values */
+static const char *tag_end(const char *p)
+{
+	char quote = 0;
+
+	for (; *p; p++) {
+		if (quote) {
+			if (*p == quote)
+				quote = 0;
+		} else if (*p == '"' || *p == '\'') {
+			quote = *p;
+		} else if (*p == '>') {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static const char *skip_past(const char *p, const char *marker)
+{
+	p = strstr(p, marker);
+	return p ? p + strlen(marker) : NULL;
+}
+
+static void add_cut(struct xml_layout *layout, int offset)
+{
+	if (layout->nr == layout->allocated) {
+		layout->allocated = (layout->nr + 16) * 2;
+		layout->cut = realloc(layout->cut, layout->allocated * sizeof(int));
+		if (!layout->cut)
+			exit(1);
+	}
+	layout->cut[layout->nr++] = offset;
+}
+
+static void free_xml_layout(struct xml_layout *layout)
+{
+	free(layout->prolog);
+	free_buffer(&layout->open);
+	free_buffer(&layout->close);
+	free(layout->cut);
+}
+
+/*
+ * Find the places where the buffer can be cut: the start tags of the
+ * dives and trips at the level of the first one, as long as they are
+ * in the same enclosing element. A piece starts at most every
+ * PARSE_CHUNK_SIZE bytes. Anything unexpected means no cuts.
+ */
+static bool find_xml_cuts(const char *buffer, struct xml_layout *layout)
+{
+	const char *p = buffer, *end, *wrapper[MAX_WRAPPERS];
+	int wrapper_len[MAX_WRAPPERS];
+	int i, depth = 0, split_depth = -1, last = 0;
+	bool closed = false;
+
+	memset(layout, 0, sizeof(*layout));
+	add_cut(layout, 0);
+	if (!strncmp(buffer, "<?xml", 5) && (end = strstr(buffer, "?>")) != NULL) {
+		layout->prolog = malloc(end + 2 - buffer + 1);
+		if (!layout->prolog)
+			exit(1);
+		memcpy(layout->prolog, buffer, end + 2 - buffer);
+		layout->prolog[end + 2 - buffer] = 0;
+	}
+	while ((p = strchr(p, '<')) != NULL && !closed) {
+		const char *name = p + 1;
+		int len;
+
+		if (!strncmp(p, "<!--", 4))
+			p = skip_past(p, "-->");
+		else if (!strncmp(p, "<![CDATA[", 9))
+			p = skip_past(p, "]]>");
+		else if (*name == '?' || *name == '!')
+			p = skip_past(p, ">");
+		else if (*name == '/') {
+			if (--depth < split_depth)
+				closed = true;
+			p = skip_past(p, ">");
+		} else {
+			if (!(end = tag_end(p)))
+				return false;
+			len = strcspn(name, " \t\r\n/>");
+			if (is_split_element(name, len)) {
+				if (split_depth < 0) {
+					if (depth > MAX_WRAPPERS)
+						return false;
+					split_depth = depth;
+					for (i = 0; i < depth; i++) {
+						char element[MAXNAME];
+
+						if (wrapper_len[i] >= MAXNAME)
+							return false;
+						memcpy(element, wrapper[i], wrapper_len[i]);
+						element[wrapper_len[i]] = 0;
+						/* the tree walk would call their rules only once */
+						if (lookup_nesting(element)->start || lookup_nesting(element)->end)
+							return false;
+						put_format(&layout->open, "<%s>", element);
+					}
+					for (i = depth - 1; i >= 0; i--) {
+						put_string(&layout->close, "</");
+						put_bytes(&layout->close, wrapper[i], wrapper_len[i]);
+						put_string(&layout->close, ">");
+					}
+				}
+				if (depth == split_depth && p - buffer - last >= PARSE_CHUNK_SIZE) {
+					last = p - buffer;
+					add_cut(layout, last);
+				}
+			}
+			if (end[-1] != '/') {
+				if (depth < MAX_WRAPPERS) {
+					wrapper[depth] = name;
+					wrapper_len[depth] = len;
+				}
+				depth++;
+			}
+			p = end + 1;
+		}
+		if (!p || depth < 0)
+			return false;
+	}
+	return layout->nr > 1;
+}
+
+static void parse_xml_chunk(void *_chunk)
+{
+	struct xml_chunk *chunk = _chunk;
+
+	chunk->doc = xmlReadMemory(chunk->text.buffer, chunk->text.len, chunk->url, NULL, 0);
+	free_buffer(&chunk->text);
+}
+
+static void fill_xml_chunk(struct xml_chunk *chunk, const char *buffer, int len,
+			   const struct xml_layout *layout, int i)
+{
+	int start = layout->cut[i];
+	int end = i + 1 < layout->nr ? layout->cut[i + 1] : len;
+
+	if (i) {
+		if (layout->prolog)
+			put_string(&chunk->text, layout->prolog);
+		put_bytes(&chunk->text, layout->open.buffer, layout->open.len);
+	}
+	put_bytes(&chunk->text, buffer + start, end - start);
+	if (i + 1 < layout->nr)
+		put_bytes(&chunk->text, layout->close.buffer, layout->close.len);
+}
+
+/* the pieces all parsed: hand the dives and trips over */
+static void commit_xml_pieces(struct dive_table *pieces, struct dive_table *table)
+{
+	int i;
+
+	for (i = 0; i < pieces->nr; i++)
+		add_dive_to_table(pieces->dives[i], table);
+	for (i = 0; i < deferred_trips.nr; i++)
+		insert_trip(deferred_trips.trips + i);
+}
+
+/* ..or they didn't, so forget about them */
+static void discard_xml_pieces(struct dive_table *pieces)
+{
+	int i;
+
+	for (i = 0; i < pieces->nr; i++)
+		free_dive(pieces->dives[i]);
+	for (i = 0; i < deferred_trips.nr; i++) {
+		free(deferred_trips.trips[i]->location);
+		free(deferred_trips.trips[i]->notes);
+		free(deferred_trips.trips[i]);
+	}
+	/* the dive and trip we were in the middle of, if any */
+	free_dive(cur_dive);
+	if (cur_trip) {
+		free(cur_trip->location);
+		free(cur_trip->notes);
+		free(cur_trip);
+	}
+	cur_dive = NULL;
+	cur_dc = NULL;
+	cur_trip = NULL;
+}
+
+/* returns false, without having recorded anything, if the file isn't
+ * worth cutting up or if one of the pieces doesn't parse */
+static bool parse_xml_parallel(const char *url, const char *buffer)
+{
+	struct xml_layout layout;
+	struct xml_chunk chunk[PARSE_BATCH];
+	void *work[PARSE_BATCH];
+	struct dive_table pieces = { 0 }, *table = target_table;
+	int len = strlen(buffer), first, i, n;
+	bool ok = true;
+
+	if (len < 2 * PARSE_CHUNK_SIZE || parallel_thread_count() < PARSE_MIN_THREADS)
+		return false;
+	if (!find_xml_cuts(buffer, &layout)) {
+		free_xml_layout(&layout);
+		return false;
+	}
+	xmlInitParser();
+	set_save_userid_local(false);
+	set_userid("");
+	reset_all();
+	target_table = &pieces;
+	deferred_trips.active = true;
+	deferred_trips.nr = 0;
+	dive_start();
+	for (first = 0; first < layout.nr && ok; first += PARSE_BATCH) {
+		n = MIN(PARSE_BATCH, layout.nr - first);
+		for (i = 0; i < n; i++) {
+			memset(chunk + i, 0, sizeof(chunk[i]));
+			chunk[i].url = url;
+			fill_xml_chunk(chunk + i, buffer, len, &layout, first + i);
+			work[i] = chunk + i;
+		}
+		run_in_parallel(parse_xml_chunk, work, n);
+		for (i = 0; i < n; i++)
+			if (!chunk[i].doc)
+				ok = false;
+		for (i = 0; i < n; i++) {
+			if (ok) {
+				/* every tree has its own dictionary */
+				reset_nesting_cache();
+				traverse(xmlDocGetRootElement(chunk[i].doc));
+			}
+			xmlFreeDoc(chunk[i].doc);
+		}
+	}
+	if (ok) {
+		dive_end();
+		commit_xml_pieces(&pieces, table);
+	} else {
+		discard_xml_pieces(&pieces);
+	}
+	deferred_trips.active = false;
+	target_table = table;
+	free(pieces.dives);
+	free_xml_layout(&layout);
+	return ok;
+}
+#endif /* PARALLEL_XML_PARSE */
+
 void parse_xml_buffer(const char *url, const char *buffer, int size,
 		      struct dive_table *table, const char **params)
 {
@@ -1686,6 +2356,16 @@ void parse_xml_buffer(const char *url, const char *buffer, int size,
 	const char *res = preprocess_divelog_de(buffer);
 
 	target_table = table;
+	/* the imports that pass parameters all go through a stylesheet */
+	if (!params && is_native_xml(url, res)) {
+#ifdef PARALLEL_XML_PARSE
+		if (!parse_xml_parallel(url, res))
+#endif
+			parse_xml_stream(url, res);
+		if (res != buffer)
+			free((char *)res);
+		return;
+	}
 	doc = xmlReadMemory(res, strlen(res), url, NULL, 0);
 	if (res != buffer)
 		free((char *)res);
@@ -1704,6 +2384,242 @@ void parse_xml_buffer(const char *url, const char *buffer, int size,
 	xmlFreeDoc(doc);
 }
 
+/*
+ * Dive computer CSV exports are a stream of samples, one per line, in
+ * the columns picked in the import dialog. They used to be wrapped into
+ * an element and turned into our XML by csv2xml.xslt, which for a big
+ * logger export means a tree of the text, the transformed tree and its
+ * text again. Instead the lines are read here, and the values go into
+ * the samples through the same entry() calls the output of the
+ * stylesheet would make. The helpers reproduce the bits of XPath that
+ * the stylesheet applies to the fields, so the result doesn't change.
+ */
+#define CSV_FIELD_SIZE 128
+
+/* number() of XPath: NaN unless the text is a single number */
+static double xpath_number(const char *text)
+{
+	const char *end;
+	double val;
+
+	while (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r')
+		text++;
+	if (*text == '+')
+		return NAN;
+	val = ascii_strtod(text, &end);
+	if (end == text || !is_blank(end))
+		return NAN;
+	return val;
+}
+
+/* string() of an XPath number */
+static void xpath_string(double val, char *buf, int size)
+{
+	xmlChar *text;
+
+	if (val == floor(val) && fabs(val) < 1e15) {
+		snprintf(buf, size, "%.0f", val ? val : 0.0);
+		return;
+	}
+	text = xmlXPathCastNumberToString(val);
+	snprintf(buf, size, "%s", text);
+	xmlFree(text);
+}
+
+/*
+ * format-number() of XSLT for patterns like '00' or '0.00': it rounds
+ * the decimal digits half away from zero, not the binary fraction.
+ */
+static void format_number(double val, int integers, int decimals, char *buf, int size)
+{
+	char digits[32];
+	double scaled = fabs(val);
+	int i;
+
+	if (isnan(val)) {
+		snprintf(buf, size, "NaN");
+		return;
+	}
+	for (i = 0; i < decimals; i++)
+		scaled *= 10;
+	snprintf(digits, sizeof(digits), "%.15g", scaled);
+	scaled = round(ascii_strtod(digits, NULL));
+	for (i = 0; i < decimals; i++)
+		scaled /= 10;
+	snprintf(buf, size, "%s%0*.*f", val < 0 ? "-" : "", integers + (decimals ? decimals + 1 : 0), decimals, scaled);
+}
+
+/*
+ * Field 'index' of the line, the way getFieldByIndex of the stylesheets
+ * picks it: an empty last field comes out as the separator itself.
+ */
+static void csv_field(const char *line, const char *end, char separator, int index, char *buf)
+{
+	const char *sep;
+	int len;
+
+	while (index-- > 0) {
+		sep = memchr(line, separator, end - line);
+		line = sep ? sep + 1 : end;
+	}
+	sep = memchr(line, separator, end - line);
+	if (!sep || (sep == line && sep + 1 == end))
+		sep = end;
+	len = sep - line;
+	if (len > CSV_FIELD_SIZE - 1)
+		len = CSV_FIELD_SIZE - 1;
+	memcpy(buf, line, len);
+	buf[len] = 0;
+}
+
+static bool csv_same_field(const char *a, const char *a_end, const char *b, const char *b_end, char separator, int index)
+{
+	char field_a[CSV_FIELD_SIZE], field_b[CSV_FIELD_SIZE];
+
+	csv_field(a, a_end, separator, index, field_a);
+	csv_field(b, b_end, separator, index, field_b);
+	return !strcmp(field_a, field_b);
+}
+
+/* what the stylesheet makes of the time field, or false if it skips the line */
+static bool csv_sample_time(const char *value, char *buf, int size)
+{
+	char before[CSV_FIELD_SIZE], number[32], *colon;
+	const char *after, *seconds;
+	double val = xpath_number(value);
+
+	if (!isnan(val)) {
+		/* seconds */
+		xpath_string(floor(val / 60), buf, size);
+		format_number(fmod(val, 60), 2, 0, number, sizeof(number));
+		snprintf(buf + strlen(buf), size - strlen(buf), ":%s", number);
+		return true;
+	}
+	colon = strchr(value, ':');
+	if (!colon)
+		return false;
+	snprintf(before, sizeof(before), "%.*s", (int)(colon - value), value);
+	if (isnan(xpath_number(before)))
+		return false;
+	after = colon + 1;
+	seconds = strchr(after, ':');
+	if (!seconds || !seconds[1]) {
+		/* m:s */
+		xpath_string(xpath_number(before) * 60 + xpath_number(after), buf, size);
+	} else {
+		/* h:m:s */
+		char minutes[CSV_FIELD_SIZE];
+
+		snprintf(minutes, sizeof(minutes), "%.*s", (int)(seconds - after), after);
+		xpath_string(xpath_number(before) * 60 + xpath_number(minutes), number, sizeof(number));
+		snprintf(buf, size, "%s:%s", number, seconds + 1);
+	}
+	return true;
+}
+
+static void csv_sample(const char *line, const char *end, const int *fields, char separator, int units)
+{
+	char value[CSV_FIELD_SIZE], buf[CSV_FIELD_SIZE];
+	static const char *names[CSV_FIELDS] = {
+		"time", "depth", "temp", "po2", "cns", "ndl", "tts", "stopdepth", "pressure"
+	};
+	int i;
+
+	csv_field(line, end, separator, fields[CSV_TIME_FIELD], value);
+	if (!csv_sample_time(value, buf, sizeof(buf)))
+		return;
+	sample_start();
+	stream_entry("time", "sample", buf);
+	for (i = CSV_DEPTH_FIELD; i < CSV_FIELDS; i++) {
+		if (fields[i] < 0 && i != CSV_DEPTH_FIELD)
+			continue;
+		csv_field(line, end, separator, fields[i], value);
+		if (units) {
+			switch (i) {
+			case CSV_DEPTH_FIELD:
+				xpath_string(xpath_number(value) * 0.3048, value, sizeof(value));
+				break;
+			case CSV_TEMP_FIELD:
+				format_number((xpath_number(value) - 32) * 5 / 9, 1, 1, buf, sizeof(buf));
+				snprintf(value, sizeof(value), "%s C", buf);
+				break;
+			case CSV_STOPDEPTH_FIELD:
+				strcpy(buf, value);
+				format_number(xpath_number(buf) * 0.3048, 1, 2, value, sizeof(value));
+				break;
+			}
+		}
+		stream_entry(names[i], "sample", value);
+		if (i == CSV_STOPDEPTH_FIELD) {
+			/* the stop depth in the file, before converting it */
+			csv_field(line, end, separator, fields[i], buf);
+			stream_entry("in_deco", "sample", xpath_number(buf) > 0 ? "1" : "0");
+		}
+	}
+	sample_end();
+}
+
+/* the end of the line at 'p', or NULL if there is no complete line left */
+static const char *csv_line_end(const char *p, const char *end)
+{
+	while (p < end && *p != '\n' && *p != '\r')
+		p++;
+	return p < end ? p : NULL;
+}
+
+static const char *csv_next_line(const char *eol, const char *end)
+{
+	if (*eol == '\r' && eol + 1 < end && eol[1] == '\n')
+		eol++;
+	return eol + 1;
+}
+
+/*
+ * Import one dive from the samples in 'buf'. Like the stylesheet did, of
+ * lines with the same time only the last one is used, and a last line
+ * without a line feed is ignored. 'units' is 0 for metric, otherwise
+ * depths are in feet and temperatures in Fahrenheit.
+ */
+int parse_csv_buffer(const char *url, const char *buf, int size, const int *fields, int separator_index, int units, struct dive_table *table)
+{
+	const char *end = buf + size, *line, *eol, *next, *next_eol, *next_end;
+	char separator = separator_index == 0 ? '\t' : separator_index == 2 ? ';' : ',';
+	char curdate[11], curtime[6];
+	time_t now;
+	struct tm *tm;
+
+	target_table = table;
+	set_save_userid_local(false);
+	set_userid("");
+	reset_all();
+	dive_start();
+
+	/* the dive is dated when it's imported */
+	time(&now);
+	tm = localtime(&now);
+	strftime(curdate, sizeof(curdate), "%Y-%m-%d", tm);
+	strftime(curtime, sizeof(curtime), "%H:%M", tm);
+	stream_entry("date", "dive", curdate);
+	stream_entry("time", "dive", curtime);
+	dc_settings_start();
+	stream_entry("deviceid", "divecomputerid", "ffffffff");
+	stream_entry("model", "divecomputerid", "csv");
+	dc_settings_end();
+
+	eol = csv_line_end(buf, end);
+	for (line = buf; eol; line = next, eol = next_eol) {
+		next = csv_next_line(eol, end);
+		next_eol = csv_line_end(next, end);
+		/* the last line is compared with an empty one */
+		next_end = next_eol ? next_eol : next;
+		if ((eol - line != next_end - next || memcmp(line, next, eol - line)) &&
+		    !csv_same_field(line, eol, next, next_end, separator, fields[CSV_TIME_FIELD]))
+			csv_sample(line, eol, fields, separator, units);
+	}
+	dive_end();
+	return 0;
+}
+
 extern int dm4_events(void *handle, int columns, char **data, char **column)
 {
 	event_start();
@@ -2030,9 +2946,9 @@ extern int shearwater_dive(void *param, int columns, char **data, char **column)
 	cur_dive->when = (time_t)(atol(data[1]));
 
 	if (data[2])
-		utf8_string(data[2], &cur_dive->location);
+		interned_string(data[2], &cur_dive->location);
 	if (data[3])
-		utf8_string(data[3], &cur_dive->buddy);
+		interned_string(data[3], &cur_dive->buddy);
 	if (data[4])
 		utf8_string(data[4], &cur_dive->notes);
 
@@ -2114,6 +3030,7 @@ void parse_xml_init(void)
 
 void parse_xml_exit(void)
 {
+	flush_stylesheets();
 	xmlCleanupParser();
 }
 
@@ -2138,6 +3055,17 @@ static struct xslt_files {
 	  { NULL, }
   };
 
+/* might the document with this root element need a stylesheet? */
+static bool has_xslt_transform(const char *root)
+{
+	struct xslt_files *info;
+
+	for (info = xslt_files; info->root; info++)
+		if (!strcasecmp(root, info->root))
+			return true;
+	return false;
+}
+
 static xmlDoc *test_xslt_transforms(xmlDoc *doc, const char **params)
 {
 	struct xslt_files *info = xslt_files;
@@ -2174,7 +3102,6 @@ static xmlDoc *test_xslt_transforms(xmlDoc *doc, const char **params)
 		}
 		transformed = xsltApplyStylesheet(xslt, doc, params);
 		xmlFreeDoc(doc);
-		xsltFreeStylesheet(xslt);
 
 		return transformed;
 	}
@@ -98,15 +98,16 @@ void set_display_transitions(bool display)
 void get_gas_at_time(struct dive *dive, struct divecomputer *dc, duration_t time, struct gasmix *gas)
 {
 	// we always start with the first gas, so that's our gas
-	// unless an event tells us otherwise
-	struct event *event = dc->events;
+	// unless an event tells us otherwise; the last gas change
+	// at or before 'time' is the one that counts
+	int i = event_upper_bound(dc, time.seconds);
 	*gas = dive->cylinder[0].gasmix;
-	while (event && event->time.seconds <= time.seconds) {
-		if (!strcmp(event->name, "gaschange")) {
-			int cylinder_idx = get_cylinder_index(dive, event);
+	while (--i >= 0) {
+		if (dc->events[i].name_id == EVENT_NAME_GASCHANGE) {
+			int cylinder_idx = get_cylinder_index(dive, dc->events + i);
 			*gas = dive->cylinder[cylinder_idx].gasmix;
+			break;
 		}
-		event = event->next;
 	}
 }
 
@@ -246,7 +247,6 @@ static void create_dive_from_plan(struct diveplan *diveplan, bool track_gas)
 	struct divecomputer *dc;
 	struct sample *sample;
 	struct gasmix oldgasmix;
-	struct event *ev;
 	cylinder_t *cyl;
 	int oldpo2 = 0;
 	int lasttime = 0;
@@ -263,14 +263,11 @@ static void create_dive_from_plan(struct diveplan *diveplan, bool track_gas)
 	reset_cylinders(&displayed_dive, track_gas);
 	dc = &displayed_dive.dc;
 	dc->when = displayed_dive.when = diveplan->when;
-	free(dc->sample);
+	dive_arena_free(dc->sample);
 	dc->sample = NULL;
 	dc->samples = 0;
 	dc->alloc_samples = 0;
-	while ((ev = dc->events)) {
-		dc->events = dc->events->next;
-		free(ev);
-	}
+	clear_dc_events(dc);
 	dp = diveplan->dp;
 	cyl = &displayed_dive.cylinder[0];
 	oldgasmix = cyl->gasmix;
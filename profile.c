@@ -294,15 +294,15 @@ int get_cylinder_index(struct dive *dive, struct event *ev)
 	int i;
 	int best = 0, score = INT_MAX;
 	int target_o2, target_he;
-	struct gasmix *g;
+	struct gasmix g;
 
 	/*
 	 * Crazy gas change events give us odd encoded o2/he in percent.
 	 * Decode into our internal permille format.
 	 */
-	g = get_gasmix_from_event(ev);
-	target_o2 = get_o2(g);
-	target_he = get_he(g);
+	get_gasmix_from_event(ev, &g);
+	target_o2 = get_o2(&g);
+	target_he = get_he(&g);
 
 	/*
 	 * Try to find a cylinder that best matches the target gas
@@ -335,10 +335,15 @@ int get_cylinder_index(struct dive *dive, struct event *ev)
 
 struct event *get_next_event(struct event *event, char *name)
 {
+	int id;
+
 	if (!name || !*name)
 		return NULL;
+	id = find_event_name_id(name);
+	if (!id)
+		return NULL;
 	while (event) {
-		if (!strcmp(event->name, name))
+		if (event->name_id == id)
 			return event;
 		event = event->next;
 	}
@@ -410,11 +415,11 @@ struct plot_info calculate_max_limits_new(struct dive *dive, struct divecomputer
 
 	/* Then do all the samples from all the dive computers */
 	do {
-		int i = dc->samples;
 		int lastdepth = 0;
-		struct sample *s = dc->sample;
+		struct sample_iter it;
+		const struct sample *s;
 
-		while (--i >= 0) {
+		for_each_sample(it, dc, s) {
 			int depth = s->depth.mm;
 			int pressure = s->cylinderpressure.mbar;
 			int temperature = s->temperature.mkelvin;
@@ -440,7 +445,6 @@ struct plot_info calculate_max_limits_new(struct dive *dive, struct divecomputer
 			    s->time.seconds > maxtime)
 				maxtime = s->time.seconds;
 			lastdepth = depth;
-			s++;
 		}
 	} while ((dc = dc->next) != NULL);
 
@@ -474,10 +478,12 @@ struct plot_info calculate_max_limits_new(struct dive *dive, struct divecomputer
 
 struct plot_data *populate_plot_entries(struct dive *dive, struct divecomputer *dc, struct plot_info *pi)
 {
-	int idx, maxtime, nr, i;
+	int idx, maxtime, nr;
 	int lastdepth, lasttime, lasttemp = 0;
 	struct plot_data *plot_data;
 	struct event *ev = dc->events;
+	struct sample_iter it;
+	const struct sample *sample;
 
 	maxtime = pi->maxtime;
 
@@ -501,9 +507,8 @@ struct plot_data *populate_plot_entries(struct dive *dive, struct divecomputer *
 	/* skip events at time = 0 */
 	while (ev && ev->time.seconds == 0)
 		ev = ev->next;
-	for (i = 0; i < dc->samples; i++) {
+	for_each_sample(it, dc, sample) {
 		struct plot_data *entry = plot_data + idx;
-		struct sample *sample = dc->sample + i;
 		int time = sample->time.seconds;
 		int depth = sample->depth.mm;
 		int offset, delta;
@@ -2,43 +2,101 @@
 #include "dive.h"
 #include "mainwindow.h"
 
-#define CREATE_UPDATE_METHOD(Class, diveStructMember)          \
-	void Class::updateModel()                              \
-	{                                                      \
-		QStringList list;                              \
-		struct dive *dive;                             \
-		int i = 0;                                     \
-		for_each_dive (i, dive)                        \
-		{                                              \
-			QString buddy(dive->diveStructMember); \
-			if (!list.contains(buddy)) {           \
-				list.append(buddy);            \
-			}                                      \
-		}                                              \
-		setStringList(list);                           \
+DiveTextCompletionModel::DiveTextCompletionModel() : valuesChanged(false)
+{
+}
+
+void DiveTextCompletionModel::addDive(struct dive *dive)
+{
+	QStringList values = diveValues(dive);
+	foreach (const QString &value, values) {
+		if (valueCount[value]++ == 0)
+			valuesChanged = true;
 	}
+	valuesOfDive.insert(dive->id, values);
+}
 
-#define CREATE_CSV_UPDATE_METHOD(Class, diveStructMember)                                        \
-	void Class::updateModel()                                                                \
-	{                                                                                        \
-		QSet<QString> set;                                                               \
-		struct dive *dive;                                                               \
-		int i = 0;                                                                       \
-		for_each_dive (i, dive)                                                          \
-		{                                                                                \
-			QString buddy(dive->diveStructMember);                                   \
-			foreach (const QString &value, buddy.split(",", QString::SkipEmptyParts)) \
-			{                                                                        \
-				set.insert(value.trimmed());                                     \
-			}                                                                        \
-		}                                                                                \
-		setStringList(set.toList());                                                     \
+void DiveTextCompletionModel::removeDive(int id)
+{
+	foreach (const QString &value, valuesOfDive.take(id)) {
+		QHash<QString, int>::iterator it = valueCount.find(value);
+		if (it != valueCount.end() && --it.value() == 0) {
+			valueCount.erase(it);
+			valuesChanged = true;
+		}
 	}
+}
+
+// the text of a dive that is already counted was edited
+void DiveTextCompletionModel::diveChanged(struct dive *dive)
+{
+	if (!valuesOfDive.contains(dive->id))
+		return;
+	removeDive(dive->id);
+	addDive(dive);
+}
+
+void DiveTextCompletionModel::updateModel()
+{
+	struct dive *dive;
+	int i;
+
+	for_each_dive (i, dive) {
+		if (!valuesOfDive.contains(dive->id))
+			addDive(dive);
+	}
+	// dive ids aren't reused, so more of them than dives means some were deleted
+	if (valuesOfDive.count() > dive_table.nr) {
+		foreach (int id, valuesOfDive.keys()) {
+			if (lookup_idx_by_uniq_id(id) < 0)
+				removeDive(id);
+		}
+	}
+	if (!valuesChanged)
+		return;
+	QStringList list = valueCount.keys();
+	list.sort();
+	setStringList(list);
+	valuesChanged = false;
+}
 
-CREATE_CSV_UPDATE_METHOD(BuddyCompletionModel, buddy);
-CREATE_CSV_UPDATE_METHOD(DiveMasterCompletionModel, divemaster);
-CREATE_UPDATE_METHOD(LocationCompletionModel, location);
-CREATE_UPDATE_METHOD(SuitCompletionModel, suit);
+static QStringList splitValues(const char *text)
+{
+	QStringList values;
+	foreach (const QString &value, QString(text).split(",", QString::SkipEmptyParts)) {
+		QString trimmed = value.trimmed();
+		if (!trimmed.isEmpty() && !values.contains(trimmed))
+			values.append(trimmed);
+	}
+	return values;
+}
+
+static QStringList singleValue(const char *text)
+{
+	if (same_string(text, ""))
+		return QStringList();
+	return QStringList(QString(text));
+}
+
+QStringList BuddyCompletionModel::diveValues(struct dive *dive) const
+{
+	return splitValues(dive->buddy);
+}
+
+QStringList DiveMasterCompletionModel::diveValues(struct dive *dive) const
+{
+	return splitValues(dive->divemaster);
+}
+
+QStringList LocationCompletionModel::diveValues(struct dive *dive) const
+{
+	return singleValue(dive->location);
+}
+
+QStringList SuitCompletionModel::diveValues(struct dive *dive) const
+{
+	return singleValue(dive->suit);
+}
 
 void TagCompletionModel::updateModel()
 {
@@ -2,29 +2,56 @@
 #define COMPLETIONMODELS_H
 
 #include <QStringListModel>
+#include <QHash>
 
-class BuddyCompletionModel : public QStringListModel {
+struct dive;
+
+/*
+ * The distinct values of one text field over all dives, counted, so
+ * that adding, editing or deleting a dive only touches its own values.
+ * The list the completer sees is only rebuilt when a value appears or
+ * disappears.
+ */
+class DiveTextCompletionModel : public QStringListModel {
 	Q_OBJECT
 public:
+	DiveTextCompletionModel();
 	void updateModel();
+	void diveChanged(struct dive *dive);
+
+protected:
+	virtual QStringList diveValues(struct dive *dive) const = 0;
+
+private:
+	void addDive(struct dive *dive);
+	void removeDive(int id);
+	QHash<int, QStringList> valuesOfDive;
+	QHash<QString, int> valueCount;
+	bool valuesChanged;
 };
 
-class DiveMasterCompletionModel : public QStringListModel {
+class BuddyCompletionModel : public DiveTextCompletionModel {
 	Q_OBJECT
-public:
-	void updateModel();
+protected:
+	QStringList diveValues(struct dive *dive) const;
 };
 
-class LocationCompletionModel : public QStringListModel {
+class DiveMasterCompletionModel : public DiveTextCompletionModel {
 	Q_OBJECT
-public:
-	void updateModel();
+protected:
+	QStringList diveValues(struct dive *dive) const;
 };
 
-class SuitCompletionModel : public QStringListModel {
+class LocationCompletionModel : public DiveTextCompletionModel {
 	Q_OBJECT
-public:
-	void updateModel();
+protected:
+	QStringList diveValues(struct dive *dive) const;
+};
+
+class SuitCompletionModel : public DiveTextCompletionModel {
+	Q_OBJECT
+protected:
+	QStringList diveValues(struct dive *dive) const;
 };
 
 class TagCompletionModel : public QStringListModel {
@@ -57,8 +57,9 @@ DiveListView::DiveListView(QWidget *parent) : QTreeView(parent), mouseClickSelec
 
 	searchBox.installEventFilter(this);
 	searchBox.hide();
-//	connect(showSearchBox, SIGNAL(triggered(bool)), this, SLOT(showSearchEdit()));
-//	connect(&searchBox, SIGNAL(textChanged(QString)), model, SLOT(setFilterFixedString(QString)));
+	searchBox.setPlaceholderText(tr("Search, e.g. depth > 40 and tag = wreck"));
+	connect(showSearchBox, SIGNAL(triggered(bool)), this, SLOT(showSearchEdit()));
+	connect(&searchBox, SIGNAL(textChanged(QString)), model, SLOT(setQueryFilter(QString)));
 }
 
 //                                #  Date  Rtg Dpth  Dur  Tmp Wght Suit  Cyl  Gas  SAC  OTU  CNS  Loc
@@ -286,13 +287,22 @@ bool DiveListView::eventFilter(QObject *, QEvent *event)
 	if (event->type() != QEvent::KeyPress)
 		return false;
 	QKeyEvent *keyEv = static_cast<QKeyEvent *>(event);
+	TagFilterSortModel *m = qobject_cast<TagFilterSortModel *>(model());
+	if (keyEv->key() == Qt::Key_Return || keyEv->key() == Qt::Key_Enter) {
+		// select what the query matched, so statistics and export work on it
+		QList<int> matches = m->queryMatches();
+		if (!matches.isEmpty()) {
+			unselectDives();
+			selectDives(matches);
+		}
+		return true;
+	}
 	if (keyEv->key() != Qt::Key_Escape)
 		return false;
 
 	searchBox.clear();
 	searchBox.hide();
-	QSortFilterProxyModel *m = qobject_cast<QSortFilterProxyModel *>(model());
-	m->setFilterFixedString(QString());
+	m->setQueryFilter(QString());
 	return true;
 }
 
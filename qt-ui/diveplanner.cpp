@@ -117,6 +117,8 @@ void DivePlannerPointsModel::loadFromDive(dive *d)
 	// if yes then the first sample should be marked
 	// if it is we only add the manually entered samples as waypoints to the diveplan
 	// otherwise we have to add all of them
+	// (this walks the samples by index, so they can't stay packed)
+	unpack_dc_samples(&d->dc);
 	bool hasMarkedSamples = d->dc.sample[0].manually_entered;
 	for (int i = 0; i < d->dc.samples - 1; i++) {
 		const sample &s = d->dc.sample[i];
@@ -188,12 +188,13 @@ void GlobeGPS::repopulateLabels()
 	loadedDives = new GeoDataDocument;
 	QMap<QString, GeoDataPlacemark *> locationMap;
 
-	int idx = 0;
-	struct dive *dive;
-	for_each_dive (idx, dive) {
-		if (dive_has_gps_location(dive)) {
+	// the coordinates come from the dive summary, the dive itself is only needed for its location name
+	const struct dive_summary *summary = get_dive_summary();
+	for (int idx = 0; idx < summary->nr; idx++) {
+		if (summary->latitude[idx] || summary->longitude[idx]) {
+			struct dive *dive = get_dive(idx);
 			GeoDataPlacemark *place = new GeoDataPlacemark(dive->location);
-			place->setCoordinate(dive->longitude.udeg / 1000000.0, dive->latitude.udeg / 1000000.0, 0, GeoDataCoordinates::Degree);
+			place->setCoordinate(summary->longitude[idx] / 1000000.0, summary->latitude[idx] / 1000000.0, 0, GeoDataCoordinates::Degree);
 			// don't add dive locations twice, unless they are at least 50m apart
 			if (locationMap[QString(dive->location)]) {
 				GeoDataCoordinates existingLocation = locationMap[QString(dive->location)]->coordinate();
@@ -318,6 +319,7 @@ void GlobeGPS::changeDiveGeoPosition(qreal lon, qreal lat, GeoDataCoordinates::U
 			continue;
 		dive->latitude.udeg = lrint(lat * 1000000.0);
 		dive->longitude.udeg = lrint(lon * 1000000.0);
+		update_dive_summary(i);
 	}
 	centerOn(lon, lat, true);
 	editingDiveLocation = false;
@@ -381,7 +381,7 @@ void MainTab::updateDiveInfo(bool clear)
 	struct dive *prevd;
 	char buf[1024];
 
-	process_selected_dives();
+	processSelectedDives();
 	process_all_dives(&displayed_dive, &prevd);
 
 	divePictureModel->updateDivePictures();
@@ -577,7 +577,7 @@ void MainTab::updateDiveInfo(bool clear)
 		if (!gasUsed.isEmpty())
 			gasUsedString.append("...");
 		volume_t o2_tot = {}, he_tot = {};
-		selected_dives_gas_parts(&o2_tot, &he_tot);
+		selectedDivesGasParts(&o2_tot, &he_tot);
 
 		/* No need to show the gas mixing information if diving
 		 * with pure air, and only display the he / O2 part when
@@ -622,6 +622,17 @@ void MainTab::addWeight_clicked()
 
 void MainTab::reload()
 {
+	// merging overlapping dives replaces a dive's text under the same id
+	int id;
+	while ((id = next_merged_dive_id()) != 0) {
+		struct dive *d = get_dive(lookup_idx_by_uniq_id(id));
+		if (!d)
+			continue;
+		buddyModel.diveChanged(d);
+		diveMasterModel.diveChanged(d);
+		locationModel.diveChanged(d);
+		suitModel.diveChanged(d);
+	}
 	suitModel.updateModel();
 	buddyModel.updateModel();
 	locationModel.updateModel();
@@ -648,10 +659,10 @@ void MainTab::reload()
 		mark_divelist_changed(true);                 \
 	} while (0)
 
-#define EDIT_TEXT(what)                                      \
-	if (same_string(mydive->what, cd->what)) {           \
-		free(mydive->what);                          \
-		mydive->what = strdup(displayed_dive.what);  \
+#define EDIT_TEXT(what)                                            \
+	if (same_string(mydive->what, cd->what)) {                 \
+		release_string(mydive->what);                      \
+		mydive->what = intern_string(displayed_dive.what); \
 	}
 
 #define EDIT_VALUE(what)                                     \
@@ -690,6 +701,8 @@ void MainTab::acceptChanges()
 		}
 		if (!same_string(displayedTrip.location, currentTrip->location)) {
 			currentTrip->location = strdup(displayedTrip.location);
+			// the trip statistics point at the trip location
+			invalidate_statistics(0);
 			mark_divelist_changed(true);
 		}
 		currentTrip = NULL;
@@ -697,7 +710,8 @@ void MainTab::acceptChanges()
 	} else {
 		if (editMode == MANUALLY_ADDED_DIVE) {
 			// preserve any changes to the profile
-			free(current_dive->dc.sample);
+			dive_arena_free(current_dive->dc.sample);
+			free(current_dive->dc.packed);
 			copy_samples(&displayed_dive.dc, &current_dive->dc);
 		}
 		struct dive *cd = current_dive;
@@ -768,8 +782,16 @@ void MainTab::acceptChanges()
 		// each dive that was selected might have had the temperatures in its active divecomputer changed
 		// so re-populate the temperatures - easiest way to do this is by calling fixup_dive
 		for_each_dive (i, d) {
-			if (d->selected)
+			if (d->selected) {
 				fixup_dive(d);
+				invalidate_oxygen_exposure(i);
+				update_dive_summary(i);
+				update_dive_text_index(d);
+				buddyModel.diveChanged(d);
+				diveMasterModel.diveChanged(d);
+				locationModel.diveChanged(d);
+				suitModel.diveChanged(d);
+			}
 		}
 	}
 	if (current_dive->divetrip) {
@@ -778,6 +800,8 @@ void MainTab::acceptChanges()
 	}
 	if (editMode == ADD || editMode == MANUALLY_ADDED_DIVE) {
 		fixup_dive(current_dive);
+		invalidate_oxygen_exposure(get_divenr(current_dive));
+		invalidate_dive_summary(get_divenr(current_dive));
 		set_dive_nr_for_current_dive();
 		MainWindow::instance()->showProfile();
 		mark_divelist_changed(true);
@@ -835,7 +859,7 @@ void MainTab::resetPallete()
 
 #define FREE_IF_DIFFERENT(what)              \
 	if (displayed_dive.what != cd->what) \
-		free(displayed_dive.what)
+		release_string(displayed_dive.what)
 
 void MainTab::rejectChanges()
 {
@@ -905,7 +929,7 @@ void MainTab::on_buddy_textChanged()
 	for (int i = 0; i < text_list.size(); i++)
 		text_list[i] = text_list[i].trimmed();
 	QString text = text_list.join(", ");
-	free(displayed_dive.buddy);
+	release_string(displayed_dive.buddy);
 	displayed_dive.buddy = strdup(text.toUtf8().data());
 	markChangedWidget(ui.buddy);
 }
@@ -918,7 +942,7 @@ void MainTab::on_divemaster_textChanged()
 	for (int i = 0; i < text_list.size(); i++)
 		text_list[i] = text_list[i].trimmed();
 	QString text = text_list.join(", ");
-	free(displayed_dive.divemaster);
+	release_string(displayed_dive.divemaster);
 	displayed_dive.divemaster = strdup(text.toUtf8().data());
 	markChangedWidget(ui.divemaster);
 }
@@ -1022,7 +1046,7 @@ void MainTab::on_location_textChanged(const QString &text)
 		free(displayedTrip.location);
 		displayedTrip.location = strdup(ui.location->text().toUtf8().data());
 	} else {
-		free(displayed_dive.location);
+		release_string(displayed_dive.location);
 		displayed_dive.location = strdup(ui.location->text().toUtf8().data());
 	}
 	markChangedWidget(ui.location);
@@ -1056,7 +1080,7 @@ void MainTab::on_suit_textChanged(const QString &text)
 {
 	if (editMode == IGNORE)
 		return;
-	free(displayed_dive.suit);
+	release_string(displayed_dive.suit);
 	displayed_dive.suit = strdup(text.toUtf8().data());
 	markChangedWidget(ui.suit);
 }
@@ -1069,7 +1093,7 @@ void MainTab::on_notes_textChanged()
 		free(displayedTrip.notes);
 		displayedTrip.notes = strdup(ui.notes->toPlainText().toUtf8().data());
 	} else {
-		free(displayed_dive.notes);
+		release_string(displayed_dive.notes);
 		if (ui.notes->toHtml().indexOf("<table") != -1)
 			displayed_dive.notes = strdup(ui.notes->toHtml().toUtf8().data());
 		else
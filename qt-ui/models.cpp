@@ -7,6 +7,7 @@
 #include "models.h"
 #include "diveplanner.h"
 #include "mainwindow.h"
+#include "preferences.h"
 #include "../helpers.h"
 #include "../dive.h"
 #include "../device.h"
@@ -1091,10 +1092,44 @@ static QVariant dive_table_alignment(int column)
 	return retVal;
 }
 
+DiveItem::DiveItem() : diveId(0), dive(NULL)
+{
+	row.totalWeight = row.nitroxSort = 0;
+}
+
+DiveItem::DiveItem(struct dive *d)
+{
+	setDive(d);
+}
+
+void DiveItem::setDive(struct dive *d)
+{
+	dive = d;
+	diveId = d ? d->id : 0;
+	refresh();
+}
+
+void DiveItem::refresh()
+{
+	if (!dive) {
+		row.totalWeight = row.nitroxSort = 0;
+		row.date = row.suit = row.cylinder = row.gas = row.location = QString();
+		return;
+	}
+	char *gas = get_dive_gas_string(dive);
+	row.totalWeight = total_weight(dive);
+	row.nitroxSort = nitrox_sort_value(dive);
+	row.date = get_dive_date_string(dive->when);
+	row.suit = QString(dive->suit);
+	row.cylinder = QString(dive->cylinder[0].type.description);
+	row.gas = QString(gas);
+	row.location = QString(dive->location);
+	free(gas);
+}
+
 QVariant DiveItem::data(int column, int role) const
 {
 	QVariant retVal;
-	struct dive *dive = get_dive_by_uniq_id(diveId);
 
 	switch (role) {
 	case Qt::TextAlignmentRole:
@@ -1122,16 +1157,16 @@ QVariant DiveItem::data(int column, int role) const
 			retVal = dive->watertemp.mkelvin;
 			break;
 		case TOTALWEIGHT:
-			retVal = total_weight(dive);
+			retVal = row.totalWeight;
 			break;
 		case SUIT:
-			retVal = QString(dive->suit);
+			retVal = row.suit;
 			break;
 		case CYLINDER:
-			retVal = QString(dive->cylinder[0].type.description);
+			retVal = row.cylinder;
 			break;
 		case GAS:
-			retVal = nitrox_sort_value(dive);
+			retVal = row.nitroxSort;
 			break;
 		case SAC:
 			retVal = dive->sac;
@@ -1143,7 +1178,7 @@ QVariant DiveItem::data(int column, int role) const
 			retVal = dive->maxcns;
 			break;
 		case LOCATION:
-			retVal = QString(dive->location);
+			retVal = row.location;
 			break;
 		}
 		break;
@@ -1169,13 +1204,13 @@ QVariant DiveItem::data(int column, int role) const
 			retVal = displayWeight();
 			break;
 		case SUIT:
-			retVal = QString(dive->suit);
+			retVal = row.suit;
 			break;
 		case CYLINDER:
-			retVal = QString(dive->cylinder[0].type.description);
+			retVal = row.cylinder;
 			break;
 		case GAS:
-			retVal = QString(get_dive_gas_string(dive));
+			retVal = row.gas;
 			break;
 		case SAC:
 			retVal = displaySac();
@@ -1187,7 +1222,7 @@ QVariant DiveItem::data(int column, int role) const
 			retVal = dive->maxcns;
 			break;
 		case LOCATION:
-			retVal = QString(dive->location);
+			retVal = row.location;
 			break;
 		}
 		break;
@@ -1232,34 +1267,29 @@ bool DiveItem::setData(const QModelIndex &index, const QVariant &value, int role
 		if (d->number == v)
 			return false;
 	}
-	d = get_dive_by_uniq_id(diveId);
-	d->number = value.toInt();
+	dive->number = value.toInt();
 	mark_divelist_changed(true);
 	return true;
 }
 
 QString DiveItem::displayDate() const
 {
-	struct dive *dive = get_dive_by_uniq_id(diveId);
-	return get_dive_date_string(dive->when);
+	return row.date;
 }
 
 QString DiveItem::displayDepth() const
 {
-	struct dive *dive = get_dive_by_uniq_id(diveId);
 	return get_depth_string(dive->maxdepth);
 }
 
 QString DiveItem::displayDepthWithUnit() const
 {
-	struct dive *dive = get_dive_by_uniq_id(diveId);
 	return get_depth_string(dive->maxdepth, true);
 }
 
 QString DiveItem::displayDuration() const
 {
 	int hrs, mins, secs;
-	struct dive *dive = get_dive_by_uniq_id(diveId);
 	secs = dive->duration.seconds % 60;
 	mins = dive->duration.seconds / 60;
 	hrs = mins / 60;
@@ -1277,7 +1307,6 @@ QString DiveItem::displayDuration() const
 QString DiveItem::displayTemperature() const
 {
 	QString str;
-	struct dive *dive = get_dive_by_uniq_id(diveId);
 	if (!dive->watertemp.mkelvin)
 		return str;
 	if (get_units()->temperature == units::CELSIUS)
@@ -1290,7 +1319,6 @@ QString DiveItem::displayTemperature() const
 QString DiveItem::displaySac() const
 {
 	QString str;
-	struct dive *dive = get_dive_by_uniq_id(diveId);
 	if (dive->sac) {
 		const char *unit;
 		int decimal;
@@ -1308,14 +1336,14 @@ QString DiveItem::displayWeight() const
 
 int DiveItem::weight() const
 {
-	struct dive *dive = get_dive_by_uniq_id(diveId);
-	weight_t tw = { total_weight(dive) };
-	return tw.grams;
+	return row.totalWeight;
 }
 
 DiveTripModel::DiveTripModel(QObject *parent) : TreeModel(parent)
 {
 	columns = COLUMNS;
+	// the cached rows hold formatted strings (date format, units)
+	connect(PreferencesDialog::instance(), SIGNAL(settingsChanged()), this, SLOT(refreshDives()));
 }
 
 Qt::ItemFlags DiveTripModel::flags(const QModelIndex &index) const
@@ -1410,8 +1438,7 @@ void DiveTripModel::setupModelData()
 		update_cylinder_related_info(dive);
 		dive_trip_t *trip = dive->divetrip;
 
-		DiveItem *diveItem = new DiveItem();
-		diveItem->diveId = dive->id;
+		DiveItem *diveItem = new DiveItem(dive);
 
 		if (!trip || currentLayout == LIST) {
 			diveItem->parent = rootItem;
@@ -1440,6 +1467,28 @@ void DiveTripModel::setupModelData()
 	}
 }
 
+void DiveTripModel::refreshDives()
+{
+	refreshDives(rootItem, QModelIndex());
+}
+
+void DiveTripModel::refreshDives(TreeItem *parent, const QModelIndex &parentIndex)
+{
+	int rows = parent->children.count();
+
+	if (!rows)
+		return;
+	for (int i = 0; i < rows; i++) {
+		TreeItem *item = parent->children[i];
+		DiveItem *diveItem = dynamic_cast<DiveItem *>(item);
+		if (diveItem)
+			diveItem->refresh();
+		else
+			refreshDives(item, index(i, 0, parentIndex));
+	}
+	emit dataChanged(index(0, 0, parentIndex), index(rows - 1, COLUMNS - 1, parentIndex));
+}
+
 DiveTripModel::Layout DiveTripModel::layout() const
 {
 	return currentLayout;
@@ -1920,7 +1969,7 @@ ProfilePrintModel::ProfilePrintModel(QObject *parent)
 
 void ProfilePrintModel::setDive(struct dive *divePtr)
 {
-	diveId = divePtr->id;
+	diveItem.setDive(divePtr);
 	// reset();
 }
 
@@ -1946,9 +1995,8 @@ QVariant ProfilePrintModel::data(const QModelIndex &index, int role) const
 
 	switch (role) {
 	case Qt::DisplayRole: {
-		struct dive *dive = get_dive_by_uniq_id(diveId);
-		struct DiveItem di;
-		di.diveId = diveId;
+		struct dive *dive = diveItem.dive;
+		const DiveItem &di = diveItem;
 
 		const QString unknown = tr("unknown");
 
@@ -2162,12 +2210,15 @@ void TagFilterModel::repopulate()
 	if (g_tag_list == NULL)
 		return;
 	QStringList list;
+	tagIds.clear();
 	struct tag_entry *current_tag_entry = g_tag_list->next;
 	while (current_tag_entry != NULL) {
 		list.append(QString(current_tag_entry->tag->name));
+		tagIds.append(current_tag_entry->tag->id);
 		current_tag_entry = current_tag_entry->next;
 	}
 	list << tr("Empty Tags");
+	tagIds.append(0);
 	setStringList(list);
 	delete[] checkState;
 	checkState = new bool[list.count()];
@@ -2193,15 +2244,88 @@ bool TagFilterModel::setData(const QModelIndex &index, const QVariant &value, in
 	return false;
 }
 
-TagFilterSortModel::TagFilterSortModel(QObject *parent) : QSortFilterProxyModel(parent)
+TagFilterSortModel::TagFilterSortModel(QObject *parent) : QSortFilterProxyModel(parent), diveBitmapValid(false),
+	query(NULL), queryBitmapValid(false)
+{
+	connect(TagFilterModel::instance(), SIGNAL(dataChanged(QModelIndex, QModelIndex)), this, SLOT(tagsChanged()));
+}
+
+TagFilterSortModel::~TagFilterSortModel()
+{
+	free_dive_query(query);
+}
+
+void TagFilterSortModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+	// a new source model means the dive list or the tags may have changed
+	invalidate_tag_bitmaps();
+	diveBitmapValid = false;
+	queryBitmapValid = false;
+	QSortFilterProxyModel::setSourceModel(sourceModel);
+}
+
+void TagFilterSortModel::tagsChanged()
+{
+	diveBitmapValid = false;
+	invalidate();
+}
+
+// an empty or unparsable query shows all dives
+void TagFilterSortModel::setQueryFilter(const QString &text)
+{
+	free_dive_query(query);
+	query = compile_dive_query(text.toUtf8().data());
+	queryBitmapValid = false;
+	invalidateFilter();
+}
+
+void TagFilterSortModel::updateQueryBitmap() const
 {
-	connect(TagFilterModel::instance(), SIGNAL(dataChanged(QModelIndex, QModelIndex)), this, SLOT(invalidate()));
+	queryBitmap.resize(DIVE_BITMAP_WORDS(dive_table.nr));
+	run_dive_query(query, queryBitmap.data());
+	queryBitmapValid = true;
+}
+
+// the dives the current query matches, as indexes into the dive table
+QList<int> TagFilterSortModel::queryMatches() const
+{
+	QList<int> matches;
+
+	if (!query)
+		return matches;
+	if (!queryBitmapValid || queryBitmap.count() != DIVE_BITMAP_WORDS(dive_table.nr))
+		updateQueryBitmap();
+	for (int i = 0; i < dive_table.nr; i++)
+		if (queryBitmap[i / 32] & (1u << (i & 31)))
+			matches.append(i);
+	return matches;
+}
+
+// the dives to show: the union of the dive bitmaps of all checked tags
+void TagFilterSortModel::updateDiveBitmap() const
+{
+	TagFilterModel *tags = TagFilterModel::instance();
+	int words = DIVE_BITMAP_WORDS(dive_table.nr);
+
+	diveBitmap.fill(0, words);
+	for (int i = 0; i < tags->rowCount() && i < tags->tagIds.count(); i++) {
+		if (!tags->checkState[i])
+			continue;
+		const uint32_t *bits = tag_dive_bitmap(tags->tagIds[i]);
+		if (!bits)
+			continue;
+		for (int j = 0; j < words; j++)
+			diveBitmap[j] |= bits[j];
+	}
+	diveBitmapValid = true;
 }
 
 bool TagFilterSortModel::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
 {
-	// If there's nothing checked, this should show everythin.
-	if (!TagFilterModel::instance()->anyChecked) {
+	bool tagFilter = TagFilterModel::instance()->anyChecked;
+
+	// If there's nothing checked and no query, this should show everythin.
+	if (!tagFilter && !query) {
 		return true;
 	}
 
@@ -2216,27 +2340,21 @@ bool TagFilterSortModel::filterAcceptsRow(int source_row, const QModelIndex &sou
 		}
 		return false;
 	}
+	int idx = get_divenr(d);
+	if (idx < 0 || idx >= dive_table.nr)
+		return false;
 	// Checked means 'Show', Unchecked means 'Hide'.
-	struct tag_entry *head = d->tag_list;
-
-	if (!head) { // last tag means "Show empty tags";
-		if (TagFilterModel::instance()->rowCount() > 0)
-			return TagFilterModel::instance()->checkState[TagFilterModel::instance()->rowCount() - 1];
-		else
-			return true;
+	if (tagFilter) {
+		if (!diveBitmapValid || diveBitmap.count() != DIVE_BITMAP_WORDS(dive_table.nr))
+			updateDiveBitmap();
+		if (!(diveBitmap[idx / 32] & (1u << (idx & 31))))
+			return false;
 	}
-
-	// have at least one tag.
-	QStringList tagList = TagFilterModel::instance()->stringList();
-	if (!tagList.isEmpty()) {
-		tagList.removeLast(); // remove the "Show Empty Tags";
-		while (head) {
-			QString tagName(head->tag->name);
-			int index = tagList.indexOf(tagName);
-			if (TagFilterModel::instance()->checkState[index])
-				return true;
-			head = head->next;
-		}
+	if (query) {
+		if (!queryBitmapValid || queryBitmap.count() != DIVE_BITMAP_WORDS(dive_table.nr))
+			updateQueryBitmap();
+		if (!(queryBitmap[idx / 32] & (1u << (idx & 31))))
+			return false;
 	}
-	return false;
+	return true;
 }
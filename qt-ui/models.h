@@ -12,10 +12,12 @@
 #include <QStringList>
 #include <QStringListModel>
 #include <QSortFilterProxyModel>
+#include <QVector>
 
 #include "../dive.h"
 #include "../divelist.h"
 #include "../divecomputer.h"
+#include "../divequery.h"
 
 QFont defaultModelFont();
 
@@ -200,8 +202,13 @@ struct DiveItem : public TreeItem {
 		COLUMNS
 	};
 
+	DiveItem();
+	explicit DiveItem(struct dive *d);
 	virtual QVariant data(int column, int role) const;
 	int diveId;
+	struct dive *dive;
+	void setDive(struct dive *d);
+	void refresh();
 	virtual bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole);
 	virtual Qt::ItemFlags flags(const QModelIndex &index) const;
 	QString displayDate() const;
@@ -212,6 +219,16 @@ struct DiveItem : public TreeItem {
 	QString displayWeight() const;
 	QString displaySac() const;
 	int weight() const;
+
+private:
+	/* the values that are expensive to compute for each call to data();
+	 * they are filled in by refresh() whenever the dive or the preferences
+	 * change */
+	struct {
+		int totalWeight;
+		int nitroxSort;
+		QString date, suit, cylinder, gas, location;
+	} row;
 };
 
 struct TripItem;
@@ -273,8 +290,13 @@ public:
 	Layout layout() const;
 	void setLayout(Layout layout);
 
+public
+slots:
+	void refreshDives();
+
 private:
 	void setupModelData();
+	void refreshDives(TreeItem *parent, const QModelIndex &parentIndex);
 	QMap<dive_trip_t *, TripItem *> trips;
 	Layout currentLayout;
 };
@@ -380,7 +402,7 @@ class ProfilePrintModel : public QAbstractTableModel {
 	Q_OBJECT
 
 private:
-	int diveId;
+	DiveItem diveItem;
 	double fontSize;
 
 public:
@@ -426,6 +448,8 @@ public:
 	virtual Qt::ItemFlags flags(const QModelIndex &index) const;
 	bool *checkState;
 	bool anyChecked;
+	// tag id of each row, the last row ("Empty Tags") has id 0
+	QVector<int> tagIds;
 public
 slots:
 	void repopulate();
@@ -438,6 +462,24 @@ class TagFilterSortModel : public QSortFilterProxyModel {
 	Q_OBJECT
 public:
 	TagFilterSortModel(QObject *parent = 0);
+	~TagFilterSortModel();
 	virtual bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const;
+	virtual void setSourceModel(QAbstractItemModel *sourceModel);
+	QList<int> queryMatches() const;
+public
+slots:
+	void setQueryFilter(const QString &text);
+private
+slots:
+	void tagsChanged();
+
+private:
+	void updateDiveBitmap() const;
+	void updateQueryBitmap() const;
+	mutable QVector<uint32_t> diveBitmap;
+	mutable bool diveBitmapValid;
+	struct dive_query *query;
+	mutable QVector<uint32_t> queryBitmap;
+	mutable bool queryBitmapValid;
 };
 #endif // MODELS_H
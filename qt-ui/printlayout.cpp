@@ -8,6 +8,7 @@
 #include <QPointer>
 #include <QPicture>
 #include <QMessageBox>
+#include <QProgressDialog>
 
 #include "mainwindow.h"
 #include "../dive.h"
@@ -130,10 +131,17 @@ int PrintLayout::estimateTotalDives() const
 
 void PrintLayout::printProfileDives(int divesPerRow, int divesPerColumn)
 {
-	int i, row = 0, col = 0, printed = 0, total = estimateTotalDives();
+	int i, row = 0, col = 0, printed = 0;
 	int animationOriginal = prefs.animation_speed;
 
 	struct dive *dive;
+	QList<struct dive *> dives;
+	for_each_dive (i, dive) {
+		if (!dive->selected && printOptions->print_selected)
+			continue;
+		dives.append(dive);
+	}
+	const int total = dives.count();
 	if (!total)
 		return;
 
@@ -176,8 +184,9 @@ void PrintLayout::printProfileDives(int divesPerRow, int divesPerColumn)
 	QPointer<QTableView> table(createProfileTable(&model, scaledW, (divesPerRow == 1) ? scaledH * 0.45 : 0.0));
 	// profilePrintTableMaxH updates after the table is created
 	const int tableH = profilePrintTableMaxH;
+	const int profileH = scaledH - tableH - padPT;
 	// resize the profile widget
-	profile->resize(scaledW, scaledH - tableH - padPT);
+	profile->resize(scaledW, profileH);
 	// offset table or profile on top
 	int yOffsetProfile = 0, yOffsetTable = 0;
 	if (printOptions->notes_up)
@@ -185,10 +194,16 @@ void PrintLayout::printProfileDives(int divesPerRow, int divesPerColumn)
 	else
 		yOffsetTable = scaledH - tableH;
 
-	// plot the dives at specific rows and columns on the page
-	for_each_dive (i, dive) {
-		if (!dive->selected && printOptions->print_selected)
-			continue;
+	QProgressDialog progress(tr("Printing dive profiles..."), tr("Cancel"), 0, total, dialog);
+	progress.setWindowModality(Qt::WindowModal);
+	progress.setMinimumDuration(0);
+
+	// plot the dives at specific rows and columns on the page.
+	// this has to stay on this thread: the plot info is calculated with the
+	// global deco state (and from the dives before this one), and the profile
+	// is drawn by rendering the scene of the profile widget
+	for (i = 0; i < total && !progress.wasCanceled(); i++) {
+		dive = dives.at(i);
 		if (col == divesPerColumn) {
 			col = 0;
 			row++;
@@ -202,15 +217,15 @@ void PrintLayout::printProfileDives(int divesPerRow, int divesPerColumn)
 		painter.translate((scaledW + padW) * col, (scaledH + padH) * row + yOffsetProfile);
 		profile->plotDive(dive, true); // make sure the profile is actually redrawn
 #ifdef Q_OS_LINUX // on Linux there is a vector line bug (big lines in PDF), which forces us to render to QImage
-		QImage image(scaledW, scaledH - tableH - padPT, QImage::Format_ARGB32);
+		QImage image(scaledW, profileH, QImage::Format_ARGB32);
 		QPainter imgPainter(&image);
 		imgPainter.setRenderHint(QPainter::Antialiasing);
 		imgPainter.setRenderHint(QPainter::SmoothPixmapTransform);
-		profile->render(&imgPainter, QRect(0, 0, scaledW, scaledH - tableH - padPT));
+		profile->render(&imgPainter, QRect(0, 0, scaledW, profileH));
 		imgPainter.end();
 		painter.drawImage(image.rect(),image);
 #else // for other OS we can try rendering the profile as vector
-		profile->render(&painter, QRect(0, 0, scaledW, scaledH - tableH - padPT));
+		profile->render(&painter, QRect(0, 0, scaledW, profileH));
 #endif
 		painter.setTransform(origTransform);
 
@@ -226,8 +241,12 @@ void PrintLayout::printProfileDives(int divesPerRow, int divesPerColumn)
 		painter.setTransform(origTransform);
 		col++;
 		printed++;
+		progress.setValue(printed);
 		emit signalProgress((printed * 100) / total);
 	}
+	if (progress.wasCanceled())
+		printer->abort();
+	progress.setValue(total);
 	// cleanup
 	painter.end();
 	profile->setFrameStyle(profileFrameStyle);
@@ -458,8 +477,7 @@ void PrintLayout::printTable()
 
 void PrintLayout::addTablePrintDataRow(TablePrintModel *model, int row, struct dive *dive) const
 {
-	struct DiveItem di;
-	di.diveId = dive->id;
+	struct DiveItem di(dive);
 	model->insertRow();
 	model->setData(model->index(row, 0), QString::number(dive->number), Qt::DisplayRole);
 	model->setData(model->index(row, 1), di.displayDate(), Qt::DisplayRole);
@@ -1165,6 +1165,8 @@ void ProfileWidget2::changeGas()
 
 	validate_gas(gas.toUtf8().constData(), &gasmix);
 	add_gas_switch_event(&displayed_dive, current_dc, seconds, get_gasidx(&displayed_dive, &gasmix));
+	// the OTU / CNS of this dive and the ones after it depend on the gas
+	invalidate_oxygen_exposure(get_divenr(&displayed_dive));
 	// this means we potentially have a new tank that is being used and needs to be shown
 	fixup_dive(&displayed_dive);
 
@@ -207,13 +207,11 @@ bool DivelogsDeWebServices::prepare_dives_for_divelogs(const QString &tempfile,
 		}
 	}
 	zip_close(zip);
-	xsltFreeStylesheet(xslt);
 	return true;
 
 error_close_zip:
 	zip_close(zip);
 	QFile::remove(tempfile);
-	xsltFreeStylesheet(xslt);
 	return false;
 }
 
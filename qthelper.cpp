@@ -11,6 +11,10 @@
 #include <QMap>
 #include <QDebug>
 #include <QSettings>
+#include <QtConcurrentMap>
+#include <QThread>
+#include <QMutex>
+#include <QHash>
 #include <libxslt/documents.h>
 
 #define translate(_context, arg) trGettext(arg)
@@ -246,8 +250,22 @@ static xmlDocPtr get_stylesheet_doc(const xmlChar *uri, xmlDictPtr, int, void *,
 	return doc;
 }
 
+static QMutex stylesheetLock;
+static QHash<QString, xsltStylesheetPtr> stylesheets;
+
+/*
+ * Compiled stylesheets are kept around for the rest of the run, so
+ * importing a pile of files of the same kind doesn't parse the same XSLT
+ * over and over. Transforming only reads the stylesheet, so the callers
+ * can share them, also from different threads, and must not free them.
+ */
 extern "C" xsltStylesheetPtr get_stylesheet(const char *name)
 {
+	QMutexLocker locker(&stylesheetLock);
+	xsltStylesheetPtr xslt = stylesheets.value(name);
+	if (xslt)
+		return xslt;
+
 	// this needs to be done only once, but doesn't hurt to run every time
 	xsltSetLoaderFunc(get_stylesheet_doc);
 
@@ -257,15 +275,51 @@ extern "C" xsltStylesheetPtr get_stylesheet(const char *name)
 		return NULL;
 
 	//	xsltSetGenericErrorFunc(stderr, NULL);
-	xsltStylesheetPtr xslt = xsltParseStylesheetDoc(doc);
+	xslt = xsltParseStylesheetDoc(doc);
 	if (!xslt) {
 		xmlFreeDoc(doc);
 		return NULL;
 	}
 
+	stylesheets.insert(name, xslt);
 	return xslt;
 }
 
+extern "C" void flush_stylesheets(void)
+{
+	QMutexLocker locker(&stylesheetLock);
+	Q_FOREACH (xsltStylesheetPtr xslt, stylesheets)
+		xsltFreeStylesheet(xslt);
+	stylesheets.clear();
+}
+
+extern "C" int parallel_thread_count(void)
+{
+	return QThread::idealThreadCount();
+}
+
+struct ParallelTask {
+	void (*fn)(void *);
+	void *data;
+};
+
+static void runParallelTask(ParallelTask &task)
+{
+	task.fn(task.data);
+}
+
+// run fn on each of the data items on the global thread pool, and wait for all of them
+extern "C" void run_in_parallel(void (*fn)(void *), void **data, int nr)
+{
+	QVector<ParallelTask> tasks(nr);
+
+	for (int i = 0; i < nr; i++) {
+		tasks[i].fn = fn;
+		tasks[i].data = data[i];
+	}
+	QtConcurrent::blockingMap(tasks, runParallelTask);
+}
+
 extern "C" void picture_load_exif_data(struct picture *p, timestamp_t *timestamp)
 {
 	EXIFInfo exif;
@@ -306,25 +360,108 @@ static bool lessThan(const QPair<QString, int> &a, const QPair<QString, int> &b)
 	return a.second < b.second;
 }
 
-void selectedDivesGasUsed(QVector<QPair<QString, int> > &gasUsedOrdered)
+/*
+ * The statistics of the selected dives are worked out in chunks of the
+ * dive table on the global thread pool. The partial results merge
+ * exactly, so the numbers are the same as those of a single pass.
+ */
+#define STATS_CHUNK_SIZE 512
+
+struct DiveRange {
+	const struct dive_summary *summary;
+	int from, to;
+};
+
+// this runs on the main thread, the summary mustn't change while the chunks are processed
+static QList<DiveRange> selectionRanges()
 {
-	int i, j;
-	struct dive *d;
-	QString gas;
-	QMap<QString, int> gasUsed;
-	for_each_dive (i, d) {
+	QList<DiveRange> ranges;
+	const struct dive_summary *summary = get_dive_summary();
+
+	for (int from = 0; from < summary->nr; from += STATS_CHUNK_SIZE) {
+		DiveRange range = { summary, from, qMin(from + STATS_CHUNK_SIZE, summary->nr) };
+		ranges.append(range);
+	}
+	return ranges;
+}
+
+static stats_t selectedStats(const DiveRange &range)
+{
+	stats_t stats = {};
+	process_selected_range(range.summary, range.from, range.to, &stats);
+	return stats;
+}
+
+void processSelectedDives()
+{
+	QList<stats_t> parts = QtConcurrent::blockingMapped<QList<stats_t> >(selectionRanges(), selectedStats);
+
+	memset(&stats_selection, 0, sizeof(stats_selection));
+	Q_FOREACH (const stats_t &part, parts)
+		merge_stats(&stats_selection, &part);
+}
+
+// gas volumes in ml by gasmix, with o2 and he permille packed into the key
+typedef QMap<int, int> GasVolumes;
+
+static GasVolumes selectedGasUsed(const DiveRange &range)
+{
+	GasVolumes volumes;
+
+	for (int i = range.from; i < range.to; i++) {
+		struct dive *d = get_dive(i);
 		if (!d->selected)
 			continue;
 		volume_t diveGases[MAX_CYLINDERS] = {};
 		get_gas_used(d, diveGases);
-		for (j = 0; j < MAX_CYLINDERS; j++)
+		for (int j = 0; j < MAX_CYLINDERS; j++) {
 			if (diveGases[j].mliter) {
-				QString gasName = gasname(&d->cylinder[j].gasmix);
-				gasUsed[gasName] += diveGases[j].mliter;
+				struct gasmix *mix = &d->cylinder[j].gasmix;
+				volumes[mix->o2.permille << 16 | mix->he.permille] += diveGases[j].mliter;
 			}
+		}
+	}
+	return volumes;
+}
+
+void selectedDivesGasUsed(QVector<QPair<QString, int> > &gasUsedOrdered)
+{
+	QString gas;
+	QMap<QString, int> gasUsed;
+	QList<GasVolumes> parts = QtConcurrent::blockingMapped<QList<GasVolumes> >(selectionRanges(), selectedGasUsed);
+
+	// gasname() uses a static buffer, so the names are only made here
+	Q_FOREACH (const GasVolumes &volumes, parts) {
+		for (GasVolumes::const_iterator it = volumes.constBegin(); it != volumes.constEnd(); ++it) {
+			struct gasmix mix = {};
+			mix.o2.permille = it.key() >> 16;
+			mix.he.permille = it.key() & 0xffff;
+			gasUsed[gasname(&mix)] += it.value();
+		}
 	}
 	Q_FOREACH(gas, gasUsed.keys()) {
 		gasUsedOrdered.append(qMakePair(gas, gasUsed[gas]));
 	}
 	qSort(gasUsedOrdered.begin(), gasUsedOrdered.end(), lessThan);
 }
+
+struct GasParts {
+	volume_t o2, he;
+};
+
+static GasParts selectedGasParts(const DiveRange &range)
+{
+	GasParts parts = {};
+	selected_dives_gas_parts_range(range.from, range.to, &parts.o2, &parts.he);
+	return parts;
+}
+
+void selectedDivesGasParts(volume_t *o2_tot, volume_t *he_tot)
+{
+	QList<GasParts> parts = QtConcurrent::blockingMapped<QList<GasParts> >(selectionRanges(), selectedGasParts);
+
+	Q_FOREACH (const GasParts &part, parts) {
+		o2_tot->mliter += part.o2.mliter;
+		he_tot->mliter += part.he.mliter;
+	}
+}
@@ -0,0 +1,303 @@
+/*
+ * Compact storage for the samples of a dive computer.
+ *
+ * A 'struct sample' has room for everything any dive computer might
+ * report, but most computers fill in just time, depth and maybe a
+ * temperature or a tank pressure, and neighbouring samples hardly
+ * differ. So the packed form stores the samples by column instead:
+ *
+ *  - channels that are zero in every sample aren't stored at all
+ *  - channels that are zero in only some samples get a presence bitmap
+ *    and only the non-zero values are stored
+ *  - the values are stored as zigzag varint encoded deltas against the
+ *    previous stored value of the same channel, so a sample with the
+ *    usual time step and a small depth change takes two or three bytes
+ *
+ * Packed samples are decoded again one at a time through the sample
+ * iterator (for_each_sample()), which also walks the plain sample
+ * array, so code using it doesn't care which form a dive computer uses.
+ * Code that needs random access or wants to modify the samples has to
+ * call unpack_dc_samples() first.
+ *
+ * process_dives() packs the dives in the table once they are loaded and
+ * merged. Copies of a dive (like displayed_dive) always get a plain array.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "dive.h"
+#include "membuffer.h"
+
+struct packed_samples {
+	int nr;
+	unsigned int len;
+	uint32_t present;		/* channels that are non-zero in some sample */
+	uint32_t sparse;		/* present channels that also have zero samples */
+	unsigned int offset[SAMPLE_CHANNELS];
+	unsigned char data[];
+};
+
+static int64_t get_channel(const struct sample *s, int channel)
+{
+	switch (channel) {
+	case SC_TIME: return s->time.seconds;
+	case SC_DEPTH: return s->depth.mm;
+	case SC_STOPTIME: return s->stoptime.seconds;
+	case SC_NDL: return s->ndl.seconds;
+	case SC_TTS: return s->tts.seconds;
+	case SC_STOPDEPTH: return s->stopdepth.mm;
+	case SC_TEMPERATURE: return s->temperature.mkelvin;
+	case SC_CYLINDERPRESSURE: return s->cylinderpressure.mbar;
+	case SC_DILUENTPRESSURE: return s->diluentpressure.mbar;
+	case SC_PO2: return s->po2.mbar;
+	case SC_O2SETPOINT: return s->o2setpoint.mbar;
+	case SC_O2SENSOR1: return s->o2sensor[0].mbar;
+	case SC_O2SENSOR2: return s->o2sensor[1].mbar;
+	case SC_O2SENSOR3: return s->o2sensor[2].mbar;
+	case SC_BEARING: return s->bearing.degrees;
+	case SC_SENSOR: return s->sensor;
+	case SC_CNS: return s->cns;
+	case SC_HEARTBEAT: return s->heartbeat;
+	case SC_IN_DECO: return s->in_deco;
+	case SC_MANUALLY_ENTERED: return s->manually_entered;
+	}
+	return 0;
+}
+
+static void set_channel(struct sample *s, int channel, int64_t val)
+{
+	switch (channel) {
+	case SC_TIME: s->time.seconds = val; break;
+	case SC_DEPTH: s->depth.mm = val; break;
+	case SC_STOPTIME: s->stoptime.seconds = val; break;
+	case SC_NDL: s->ndl.seconds = val; break;
+	case SC_TTS: s->tts.seconds = val; break;
+	case SC_STOPDEPTH: s->stopdepth.mm = val; break;
+	case SC_TEMPERATURE: s->temperature.mkelvin = val; break;
+	case SC_CYLINDERPRESSURE: s->cylinderpressure.mbar = val; break;
+	case SC_DILUENTPRESSURE: s->diluentpressure.mbar = val; break;
+	case SC_PO2: s->po2.mbar = val; break;
+	case SC_O2SETPOINT: s->o2setpoint.mbar = val; break;
+	case SC_O2SENSOR1: s->o2sensor[0].mbar = val; break;
+	case SC_O2SENSOR2: s->o2sensor[1].mbar = val; break;
+	case SC_O2SENSOR3: s->o2sensor[2].mbar = val; break;
+	case SC_BEARING: s->bearing.degrees = val; break;
+	case SC_SENSOR: s->sensor = val; break;
+	case SC_CNS: s->cns = val; break;
+	case SC_HEARTBEAT: s->heartbeat = val; break;
+	case SC_IN_DECO: s->in_deco = val; break;
+	case SC_MANUALLY_ENTERED: s->manually_entered = val; break;
+	}
+}
+
+static void put_varint(struct membuffer *b, int64_t val)
+{
+	/* zigzag, so that small negative deltas stay small */
+	uint64_t v = ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+	char buf[10];
+	int len = 0;
+
+	while (v >= 0x80) {
+		buf[len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[len++] = v;
+	put_bytes(b, buf, len);
+}
+
+static int64_t get_varint(const unsigned char **pos)
+{
+	const unsigned char *p = *pos;
+	uint64_t v = 0;
+	int shift = 0;
+
+	do {
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*pos = p;
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* time and depth are never worth a presence bitmap */
+static inline bool always_dense(int channel)
+{
+	return channel == SC_TIME || channel == SC_DEPTH;
+}
+
+struct packed_samples *pack_samples(const struct sample *sample, int nr)
+{
+	struct membuffer b = { 0 };
+	struct packed_samples *p;
+	uint32_t present = 0, zero = 0;
+	unsigned int offset[SAMPLE_CHANNELS];
+	int i, channel;
+
+	for (i = 0; i < nr; i++) {
+		for (channel = 0; channel < SAMPLE_CHANNELS; channel++) {
+			if (get_channel(sample + i, channel))
+				present |= 1u << channel;
+			else
+				zero |= 1u << channel;
+		}
+	}
+	present |= (1u << SC_TIME) | (1u << SC_DEPTH);
+
+	for (channel = 0; channel < SAMPLE_CHANNELS; channel++) {
+		bool sparse = (zero & (1u << channel)) && !always_dense(channel);
+		int64_t prev = 0;
+
+		offset[channel] = b.len;
+		if (!(present & (1u << channel)))
+			continue;
+		if (sparse) {
+			int bytes = (nr + 7) / 8;
+			char *bitmap = calloc(bytes, 1);
+			if (!bitmap)
+				exit(1);
+			for (i = 0; i < nr; i++)
+				if (get_channel(sample + i, channel))
+					bitmap[i / 8] |= 1 << (i & 7);
+			put_bytes(&b, bitmap, bytes);
+			free(bitmap);
+		}
+		for (i = 0; i < nr; i++) {
+			int64_t val = get_channel(sample + i, channel);
+			if (sparse && !val)
+				continue;
+			put_varint(&b, val - prev);
+			prev = val;
+		}
+	}
+
+	p = malloc(sizeof(*p) + b.len);
+	if (!p)
+		exit(1);
+	p->nr = nr;
+	p->len = b.len;
+	p->present = present;
+	p->sparse = present & zero & ~((1u << SC_TIME) | (1u << SC_DEPTH));
+	memcpy(p->offset, offset, sizeof(offset));
+	if (b.len)
+		memcpy(p->data, b.buffer, b.len);
+	free_buffer(&b);
+	return p;
+}
+
+struct packed_samples *copy_packed_samples(const struct packed_samples *p)
+{
+	struct packed_samples *copy;
+
+	if (!p)
+		return NULL;
+	copy = malloc(sizeof(*p) + p->len);
+	if (!copy)
+		exit(1);
+	memcpy(copy, p, sizeof(*p) + p->len);
+	return copy;
+}
+
+unsigned int packed_samples_size(const struct packed_samples *p)
+{
+	return p ? sizeof(*p) + p->len : 0;
+}
+
+void sample_iter_init(struct sample_iter *it, const struct divecomputer *dc)
+{
+	const struct packed_samples *p = dc->packed;
+	int channel;
+
+	it->dc = dc;
+	it->i = 0;
+	if (dc->sample || !p)
+		return;
+	memset(&it->sample, 0, sizeof(it->sample));
+	for (channel = 0; channel < SAMPLE_CHANNELS; channel++) {
+		it->pos[channel] = p->data + p->offset[channel];
+		if (p->sparse & (1u << channel))
+			it->pos[channel] += (p->nr + 7) / 8;
+		it->prev[channel] = 0;
+	}
+}
+
+const struct sample *sample_iter_next(struct sample_iter *it)
+{
+	const struct divecomputer *dc = it->dc;
+	const struct packed_samples *p = dc->packed;
+	int channel, i = it->i;
+
+	if (dc->sample || !p)
+		return i < dc->samples ? dc->sample + it->i++ : NULL;
+	if (i >= p->nr)
+		return NULL;
+	for (channel = 0; channel < SAMPLE_CHANNELS; channel++) {
+		uint32_t bit = 1u << channel;
+		int64_t val = 0;
+
+		if (!(p->present & bit))
+			continue;
+		if (!(p->sparse & bit) ||
+		    (p->data[p->offset[channel] + i / 8] & (1 << (i & 7)))) {
+			it->prev[channel] += get_varint(it->pos + channel);
+			val = it->prev[channel];
+		}
+		set_channel(&it->sample, channel, val);
+	}
+	it->i++;
+	return &it->sample;
+}
+
+void unpack_samples(const struct packed_samples *p, struct sample *out)
+{
+	struct divecomputer dc = { 0 };
+	struct sample_iter it;
+	const struct sample *s;
+
+	dc.packed = (struct packed_samples *)p;
+	for_each_sample(it, &dc, s)
+		*out++ = *s;
+}
+
+/* replace the sample array of a dive computer by its packed form */
+void pack_dc_samples(struct divecomputer *dc)
+{
+	if (!dc->sample)
+		return;
+	dc->packed = pack_samples(dc->sample, dc->samples);
+	dive_arena_free(dc->sample);
+	dc->sample = NULL;
+	dc->alloc_samples = 0;
+}
+
+/* ..and back, for code that needs random access or changes samples */
+void unpack_dc_samples(struct divecomputer *dc)
+{
+	struct packed_samples *p = dc->packed;
+
+	if (!p)
+		return;
+	dc->samples = p->nr;
+	dc->alloc_samples = p->nr;
+	dc->sample = malloc(p->nr * sizeof(struct sample));
+	if (!dc->sample)
+		exit(1);
+	unpack_samples(p, dc->sample);
+	dc->packed = NULL;
+	free(p);
+}
+
+/*
+ * Pack all dives in the dive table, once they have been loaded or
+ * imported and merged. Dives that get edited are unpacked again on
+ * the way (by fixup_dive() and friends) and stay that way until the
+ * next time this runs.
+ */
+void pack_dive_table(void)
+{
+	int i;
+	struct dive *dive;
+	struct divecomputer *dc;
+
+	for_each_dive(i, dive)
+		for_each_dc(dive, dc)
+			pack_dc_samples(dc);
+}
@@ -222,7 +222,7 @@ static void show_index(struct membuffer *b, int value, const char *pre, const ch
  *
  * For parsing, look at the units to figure out what the numbers are.
  */
-static void save_sample(struct membuffer *b, struct sample *sample, struct sample *old)
+static void save_sample(struct membuffer *b, const struct sample *sample, struct sample *old)
 {
 	put_format(b, "%3u:%02u", FRACTION(sample->time.seconds, 60));
 	put_milli(b, " ", sample->depth.mm, "m");
@@ -275,14 +275,14 @@ static void save_sample(struct membuffer *b, struct sample *sample, struct sampl
 	put_format(b, "\n");
 }
 
-static void save_samples(struct membuffer *b, int nr, struct sample *s)
+static void save_samples(struct membuffer *b, struct divecomputer *dc)
 {
 	struct sample dummy = {};
+	struct sample_iter it;
+	const struct sample *s;
 
-	while (--nr >= 0) {
+	for_each_sample(it, dc, s)
 		save_sample(b, s, &dummy);
-		s++;
-	}
 }
 
 static void save_one_event(struct membuffer *b, struct event *ev)
@@ -322,7 +322,7 @@ static void save_dc(struct membuffer *b, struct dive *dive, struct divecomputer
 	put_duration(b, dc->surfacetime, "surfacetime ", "min\n");
 
 	save_events(b, dc->events);
-	save_samples(b, dc->samples, dc->sample);
+	save_samples(b, dc);
 }
 
 /*
@@ -153,19 +153,18 @@ static void put_cylinder_HTML(struct membuffer *b, struct dive *dive)
 
 void put_HTML_samples(struct membuffer *b, struct dive *dive)
 {
-	int i;
+	struct sample_iter it;
+	const struct sample *s;
 	put_format(b, "\"maxdepth\":%d,", dive->dc.maxdepth.mm);
 	put_format(b, "\"duration\":%d,", dive->dc.duration.seconds);
-	struct sample *s = dive->dc.sample;
 
 	if (!dive->dc.samples)
 		return;
 
 	char *separator = "\"samples\":[";
-	for (i = 0; i < dive->dc.samples; i++) {
+	for_each_sample(it, &dive->dc, s) {
 		put_format(b, "%s[%d,%d,%d,%d]", separator, s->time.seconds, s->depth.mm, s->cylinderpressure.mbar, s->temperature.mkelvin);
 		separator = ", ";
-		s++;
 	}
 	put_string(b, "],");
 }
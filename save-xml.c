@@ -201,7 +201,7 @@ static void show_index(struct membuffer *b, int value, const char *pre, const ch
 		put_format(b, " %s%d%s", pre, value, post);
 }
 
-static void save_sample(struct membuffer *b, struct sample *sample, struct sample *old)
+static void save_sample(struct membuffer *b, const struct sample *sample, struct sample *old)
 {
 	put_format(b, "  <sample time='%u:%02u min'", FRACTION(sample->time.seconds, 60));
 	put_milli(b, " depth='", sample->depth.mm, " m'");
@@ -300,14 +300,14 @@ static void show_date(struct membuffer *b, timestamp_t when)
 		   tm.tm_hour, tm.tm_min, tm.tm_sec);
 }
 
-static void save_samples(struct membuffer *b, int nr, struct sample *s)
+static void save_samples(struct membuffer *b, struct divecomputer *dc)
 {
 	struct sample dummy = {};
+	struct sample_iter it;
+	const struct sample *s;
 
-	while (--nr >= 0) {
+	for_each_sample(it, dc, s)
 		save_sample(b, s, &dummy);
-		s++;
-	}
 }
 
 static void save_dc(struct membuffer *b, struct dive *dive, struct divecomputer *dc)
@@ -330,7 +330,7 @@ static void save_dc(struct membuffer *b, struct dive *dive, struct divecomputer
 	put_duration(b, dc->surfacetime, "  <surfacetime>", " min</surfacetime>\n");
 
 	save_events(b, dc->events);
-	save_samples(b, dc->samples, dc->sample);
+	save_samples(b, dc);
 
 	put_format(b, "  </divecomputer>\n");
 }
@@ -629,7 +629,6 @@ int export_dives_xslt(const char *filename, const bool selected, const char *exp
 	} else {
 		res = report_error("Failed to open %s for writing (%s)", filename, strerror(errno));
 	}
-	xsltFreeStylesheet(xslt);
 	xmlFreeDoc(transformed);
 
 	return res;
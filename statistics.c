@@ -4,6 +4,7 @@
  * char *get_time_string(int seconds, int maxdays);
  * char *get_minutes(int seconds);
  * void process_all_dives(struct dive *dive, struct dive **prev_dive);
+ * void invalidate_statistics(int idx);
  * void get_selected_dives_text(char *buffer, int size);
  */
 #include "gettext.h"
@@ -21,64 +22,75 @@ stats_t *stats_monthly = NULL;
 stats_t *stats_yearly = NULL;
 stats_t *stats_by_trip = NULL;
 
-static void process_temperatures(struct dive *dp, stats_t *stats)
+/*
+ * Statistics are a reduction: every dive makes a stats_t of its own,
+ * and those are merged in. Everything merge_stats() does is an integer
+ * sum, minimum or maximum, so the result doesn't depend on the order
+ * or grouping of the dives, which lets the UI split a big selection
+ * into chunks and merge the partial results. A zero minimum means
+ * "none yet".
+ */
+void merge_stats(stats_t *a, const stats_t *b)
 {
-	int min_temp, mean_temp, max_temp = 0;
-
-	max_temp = dp->maxtemp.mkelvin;
-	if (max_temp && (!stats->max_temp || max_temp > stats->max_temp))
-		stats->max_temp = max_temp;
-
-	min_temp = dp->mintemp.mkelvin;
-	if (min_temp && (!stats->min_temp || min_temp < stats->min_temp))
-		stats->min_temp = min_temp;
-
-	if (min_temp || max_temp) {
-		mean_temp = min_temp;
-		if (mean_temp)
-			mean_temp = (mean_temp + max_temp) / 2;
-		else
-			mean_temp = max_temp;
-		stats->combined_temp += get_temp_units(mean_temp, NULL);
-		stats->combined_count++;
-	}
+	a->selection_size += b->selection_size;
+	a->total_time.seconds += b->total_time.seconds;
+	if (b->longest_time.seconds > a->longest_time.seconds)
+		a->longest_time = b->longest_time;
+	if (b->shortest_time.seconds && (!a->shortest_time.seconds || b->shortest_time.seconds < a->shortest_time.seconds))
+		a->shortest_time = b->shortest_time;
+	if (b->max_depth.mm > a->max_depth.mm)
+		a->max_depth = b->max_depth;
+	if (b->min_depth.mm && (!a->min_depth.mm || b->min_depth.mm < a->min_depth.mm))
+		a->min_depth = b->min_depth;
+	if (b->max_sac.mliter > a->max_sac.mliter)
+		a->max_sac = b->max_sac;
+	if (b->min_sac.mliter && (!a->min_sac.mliter || b->min_sac.mliter < a->min_sac.mliter))
+		a->min_sac = b->min_sac;
+	if (b->max_temp > a->max_temp)
+		a->max_temp = b->max_temp;
+	if (b->min_temp && (!a->min_temp || b->min_temp < a->min_temp))
+		a->min_temp = b->min_temp;
+	a->depth_time += b->depth_time;
+	a->total_sac_time += b->total_sac_time;
+	a->sac_volume += b->sac_volume;
+	a->total_temp += b->total_temp;
+	a->combined_count += b->combined_count;
+
+	a->avg_depth.mm = a->total_time.seconds ? a->depth_time / a->total_time.seconds : 0;
+	a->avg_sac.mliter = a->total_sac_time ? a->sac_volume / a->total_sac_time : 0;
+	/* the UI divides this by combined_count again */
+	a->combined_temp = a->combined_count ? get_temp_units(a->total_temp / a->combined_count, NULL) * a->combined_count : 0;
 }
 
-static void process_dive(struct dive *dp, stats_t *stats)
+/* account for the dive in row 'i' of the dive summary */
+static void process_dive(const struct dive_summary *s, int i, stats_t *stats)
 {
-	int old_tt, sac_time = 0;
-	int duration = dp->duration.seconds;
-
-	old_tt = stats->total_time.seconds;
-	stats->total_time.seconds += duration;
-	if (duration > stats->longest_time.seconds)
-		stats->longest_time.seconds = duration;
-	if (stats->shortest_time.seconds == 0 || duration < stats->shortest_time.seconds)
-		stats->shortest_time.seconds = duration;
-	if (dp->maxdepth.mm > stats->max_depth.mm)
-		stats->max_depth.mm = dp->maxdepth.mm;
-	if (stats->min_depth.mm == 0 || dp->maxdepth.mm < stats->min_depth.mm)
-		stats->min_depth.mm = dp->maxdepth.mm;
-
-	process_temperatures(dp, stats);
+	stats_t dive = { 0 };
+	int duration = s->duration[i];
+	int min_temp = s->mintemp[i];
+	int max_temp = s->maxtemp[i];
+	int sac = s->sac[i];
+
+	dive.total_time.seconds = duration;
+	dive.shortest_time.seconds = dive.longest_time.seconds = duration;
+	dive.max_depth.mm = dive.min_depth.mm = s->maxdepth[i];
+	dive.max_temp = max_temp;
+	dive.min_temp = min_temp;
+	if (min_temp || max_temp) {
+		dive.total_temp = min_temp ? (min_temp + max_temp) / 2 : max_temp;
+		dive.combined_count = 1;
+	}
 
 	/* Maybe we should drop zero-duration dives */
-	if (!duration)
-		return;
-	stats->avg_depth.mm = (1.0 * old_tt * stats->avg_depth.mm +
-			       duration * dp->meandepth.mm) /
-			      stats->total_time.seconds;
-	if (dp->sac > 100) { /* less than .1 l/min is bogus, even with a pSCR */
-		sac_time = stats->total_sac_time + duration;
-		stats->avg_sac.mliter = (1.0 * stats->total_sac_time * stats->avg_sac.mliter +
-					 duration * dp->sac) /
-					sac_time;
-		if (dp->sac > stats->max_sac.mliter)
-			stats->max_sac.mliter = dp->sac;
-		if (stats->min_sac.mliter == 0 || dp->sac < stats->min_sac.mliter)
-			stats->min_sac.mliter = dp->sac;
-		stats->total_sac_time = sac_time;
+	if (duration) {
+		dive.depth_time = (int64_t)duration * s->meandepth[i];
+		if (sac > 100) { /* less than .1 l/min is bogus, even with a pSCR */
+			dive.max_sac.mliter = dive.min_sac.mliter = sac;
+			dive.total_sac_time = duration;
+			dive.sac_volume = (int64_t)duration * sac;
+		}
 	}
+	merge_stats(stats, &dive);
 }
 
 char *get_minutes(int seconds)
@@ -88,123 +100,188 @@ char *get_minutes(int seconds)
 	return buf;
 }
 
-void process_all_dives(struct dive *dive, struct dive **prev_dive)
+/*
+ * The yearly, monthly and per trip statistics are built in one pass over
+ * the dive summary in table order and kept between calls, together with
+ * where that pass stopped. Dives that get added at the end of the table
+ * are simply folded into the open periods; any other change to the dives
+ * that were already counted means starting over, as the minimums and
+ * maximums can't be taken back out again.
+ */
+static struct {
+	int nr;				/* summary rows accounted for */
+	int allocated;			/* entries in the stats arrays */
+	int year_iter, month_iter, trip_iter;
+	int current_year, current_month;
+	dive_trip_t *trip_ptr;
+	bool restart;
+} stats_pass;
+
+void invalidate_statistics(int idx)
 {
-	int idx;
-	struct dive *dp;
-	struct tm tm;
-	int current_year = 0;
-	int current_month = 0;
-	int year_iter = 0;
-	int month_iter = 0;
-	int prev_month = 0, prev_year = 0;
-	int trip_iter = 0;
-	dive_trip_t *trip_ptr = 0;
-	unsigned int size;
-
-	*prev_dive = NULL;
-	memset(&stats, 0, sizeof(stats));
-	if (dive_table.nr > 0) {
-		stats.shortest_time.seconds = dive_table.dives[0]->duration.seconds;
-		stats.min_depth.mm = dive_table.dives[0]->maxdepth.mm;
-		stats.selection_size = dive_table.nr;
-	}
+	if (idx < 0)
+		idx = 0;
+	if (idx < stats_pass.nr)
+		stats_pass.restart = true;
+}
 
+static bool grow_stats(int nr)
+{
 	/* allocate sufficient space to hold the worst
 	 * case (one dive per year or all dives during
 	 * one month) for yearly and monthly statistics*/
+	int allocated = (nr + 32) * 3 / 2;
+	size_t size = sizeof(stats_t) * allocated, old = sizeof(stats_t) * stats_pass.allocated;
+	stats_t *yearly, *monthly, *by_trip;
+
+	yearly = realloc(stats_yearly, size);
+	if (yearly)
+		stats_yearly = yearly;
+	monthly = realloc(stats_monthly, size);
+	if (monthly)
+		stats_monthly = monthly;
+	by_trip = realloc(stats_by_trip, size);
+	if (by_trip)
+		stats_by_trip = by_trip;
+	if (!yearly || !monthly || !by_trip)
+		return false;
+	memset(stats_yearly + stats_pass.allocated, 0, size - old);
+	memset(stats_monthly + stats_pass.allocated, 0, size - old);
+	memset(stats_by_trip + stats_pass.allocated, 0, size - old);
+	stats_pass.allocated = allocated;
+	return true;
+}
 
-	free(stats_yearly);
-	free(stats_monthly);
-	free(stats_by_trip);
+static void restart_stats_pass(void)
+{
+	size_t size = sizeof(stats_t) * stats_pass.allocated;
 
-	size = sizeof(stats_t) * (dive_table.nr + 1);
-	stats_yearly = malloc(size);
-	stats_monthly = malloc(size);
-	stats_by_trip = malloc(size);
-	if (!stats_yearly || !stats_monthly || !stats_by_trip)
-		return;
+	memset(&stats, 0, sizeof(stats));
 	memset(stats_yearly, 0, size);
 	memset(stats_monthly, 0, size);
 	memset(stats_by_trip, 0, size);
 	stats_yearly[0].is_year = true;
+	stats_by_trip[0].location = "All (by trip stats)";
+	stats_pass.year_iter = stats_pass.month_iter = stats_pass.trip_iter = 0;
+	stats_pass.current_year = stats_pass.current_month = 0;
+	stats_pass.trip_ptr = NULL;
+	stats_pass.nr = 0;
+	stats_pass.restart = false;
+}
 
-	/* this relies on the fact that the dives in the dive_table
-	 * are in chronological order */
-	for_each_dive (idx, dp) {
-		if (dive && dp->when == dive->when) {
-			/* that's the one we are showing */
-			if (idx > 0)
-				*prev_dive = dive_table.dives[idx - 1];
-		}
-		process_dive(dp, &stats);
+/* this relies on the fact that the dives in the dive_table
+ * are in chronological order */
+static void process_summary_rows(const struct dive_summary *s, int from)
+{
+	int idx;
+	int year_iter = stats_pass.year_iter;
+	int month_iter = stats_pass.month_iter;
+	int trip_iter = stats_pass.trip_iter;
+	int current_year = stats_pass.current_year;
+	int current_month = stats_pass.current_month;
+	int prev_month = current_month, prev_year = current_year;
+	dive_trip_t *trip_ptr = stats_pass.trip_ptr;
+
+	for (idx = from; idx < s->nr; idx++) {
+		process_dive(s, idx, &stats);
 
 		/* yearly statistics */
-		utc_mkdate(dp->when, &tm);
 		if (current_year == 0)
-			current_year = tm.tm_year + 1900;
+			current_year = s->year[idx];
 
-		if (current_year != tm.tm_year + 1900) {
-			current_year = tm.tm_year + 1900;
-			process_dive(dp, &(stats_yearly[++year_iter]));
+		if (current_year != s->year[idx]) {
+			current_year = s->year[idx];
+			process_dive(s, idx, &(stats_yearly[++year_iter]));
 			stats_yearly[year_iter].is_year = true;
 		} else {
-			process_dive(dp, &(stats_yearly[year_iter]));
+			process_dive(s, idx, &(stats_yearly[year_iter]));
 		}
 		stats_yearly[year_iter].selection_size++;
 		stats_yearly[year_iter].period = current_year;
 
-		if (dp->divetrip != NULL) {
-			if (trip_ptr != dp->divetrip) {
-				trip_ptr = dp->divetrip;
+		if (s->trip[idx] != NULL) {
+			if (trip_ptr != s->trip[idx]) {
+				trip_ptr = s->trip[idx];
 				trip_iter++;
 			}
 
 			/* stats_by_trip[0] is all the dives combined */
 			stats_by_trip[0].selection_size++;
-			process_dive(dp, &(stats_by_trip[0]));
+			process_dive(s, idx, &(stats_by_trip[0]));
 			stats_by_trip[0].is_trip = true;
-			stats_by_trip[0].location = strdup("All (by trip stats)");
 
-			process_dive(dp, &(stats_by_trip[trip_iter]));
+			process_dive(s, idx, &(stats_by_trip[trip_iter]));
 			stats_by_trip[trip_iter].selection_size++;
 			stats_by_trip[trip_iter].is_trip = true;
-			stats_by_trip[trip_iter].location = dp->divetrip->location;
+			stats_by_trip[trip_iter].location = trip_ptr->location;
 		}
 
 		/* monthly statistics */
 		if (current_month == 0) {
-			current_month = tm.tm_mon + 1;
+			current_month = s->month[idx];
 		} else {
-			if (current_month != tm.tm_mon + 1)
-				current_month = tm.tm_mon + 1;
+			if (current_month != s->month[idx])
+				current_month = s->month[idx];
 			if (prev_month != current_month || prev_year != current_year)
 				month_iter++;
 		}
-		process_dive(dp, &(stats_monthly[month_iter]));
+		process_dive(s, idx, &(stats_monthly[month_iter]));
 		stats_monthly[month_iter].selection_size++;
 		stats_monthly[month_iter].period = current_month;
 		prev_month = current_month;
 		prev_year = current_year;
 	}
+	stats_pass.year_iter = year_iter;
+	stats_pass.month_iter = month_iter;
+	stats_pass.trip_iter = trip_iter;
+	stats_pass.current_year = current_year;
+	stats_pass.current_month = current_month;
+	stats_pass.trip_ptr = trip_ptr;
+	stats_pass.nr = s->nr;
 }
 
-/* make sure we skip the selected summary entries */
-void process_selected_dives(void)
+void process_all_dives(struct dive *dive, struct dive **prev_dive)
 {
-	struct dive *dive;
-	unsigned int i, nr;
+	const struct dive_summary *s = get_dive_summary();
+	int idx;
 
-	memset(&stats_selection, 0, sizeof(stats_selection));
+	/* the dive we are showing and the one before it */
+	idx = get_divenr(dive);
+	*prev_dive = idx > 0 ? get_dive(idx - 1) : NULL;
+
+	if (!stats_pass.allocated || stats_pass.nr > s->nr)
+		stats_pass.restart = true;
+	if (s->nr + 1 > stats_pass.allocated && !grow_stats(s->nr + 1)) {
+		stats_pass.restart = true;
+		return;
+	}
+	if (stats_pass.restart)
+		restart_stats_pass();
+	if (stats_pass.nr < s->nr)
+		process_summary_rows(s, stats_pass.nr);
+	stats.selection_size = s->nr;
+}
+
+/* the selected dives among rows 'from' to 'to' (exclusive) of the summary */
+void process_selected_range(const struct dive_summary *s, int from, int to, stats_t *stats)
+{
+	int i;
 
-	nr = 0;
-	for_each_dive(i, dive) {
-		if (dive->selected) {
-			process_dive(dive, &stats_selection);
-			nr++;
+	for (i = from; i < to; i++) {
+		if (dive_table.dives[i]->selected) {
+			process_dive(s, i, stats);
+			stats->selection_size++;
 		}
 	}
-	stats_selection.selection_size = nr;
+}
+
+/* make sure we skip the selected summary entries */
+void process_selected_dives(void)
+{
+	const struct dive_summary *s = get_dive_summary();
+
+	memset(&stats_selection, 0, sizeof(stats_selection));
+	process_selected_range(s, 0, s->nr, &stats_selection);
 }
 
 char *get_time_string(int seconds, int maxdays)
@@ -347,11 +424,12 @@ static void get_gas_parts(struct gasmix mix, volume_t vol, int o2_in_topup, volu
 	o2->mliter += vol.mliter - he->mliter - air.mliter;
 }
 
-void selected_dives_gas_parts(volume_t *o2_tot, volume_t *he_tot)
+void selected_dives_gas_parts_range(int from, int to, volume_t *o2_tot, volume_t *he_tot)
 {
 	int i, j;
-	struct dive *d;
-	for_each_dive (i, d) {
+
+	for (i = from; i < to; i++) {
+		struct dive *d = dive_table.dives[i];
 		if (!d->selected)
 			continue;
 		volume_t diveGases[MAX_CYLINDERS] = {};
@@ -366,3 +444,8 @@ void selected_dives_gas_parts(volume_t *o2_tot, volume_t *he_tot)
 		}
 	}
 }
+
+void selected_dives_gas_parts(volume_t *o2_tot, volume_t *he_tot)
+{
+	selected_dives_gas_parts_range(0, dive_table.nr, o2_tot, he_tot);
+}
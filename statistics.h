@@ -31,6 +31,10 @@ typedef struct
 	unsigned int combined_count;
 	unsigned int selection_size;
 	unsigned int total_sac_time;
+	/* exact sums behind the averages, so that merging is exact, too */
+	int64_t depth_time;	/* duration * mean depth */
+	int64_t sac_volume;	/* duration * sac */
+	int64_t total_temp;	/* mean temperatures in mkelvin */
 	bool is_year;
 	bool is_trip;
 	char *location;
@@ -43,10 +47,14 @@ extern stats_t *stats_by_trip;
 extern char *get_time_string(int seconds, int maxdays);
 extern char *get_minutes(int seconds);
 extern void process_all_dives(struct dive *dive, struct dive **prev_dive);
+extern void invalidate_statistics(int idx);
 extern void get_selected_dives_text(char *buffer, int size);
 extern void get_gas_used(struct dive *dive, volume_t gases[MAX_CYLINDERS]);
 extern void process_selected_dives(void);
+extern void process_selected_range(const struct dive_summary *s, int from, int to, stats_t *stats);
+extern void merge_stats(stats_t *a, const stats_t *b);
 void selected_dives_gas_parts(volume_t *o2_tot, volume_t *he_tot);
+void selected_dives_gas_parts_range(int from, int to, volume_t *o2_tot, volume_t *he_tot);
 
 #ifdef __cplusplus
 }
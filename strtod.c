@@ -27,6 +27,8 @@
  * they have locales with commas", just pass in a zero flag.
  */
 #include <ctype.h>
+#include <limits.h>
+#include <math.h>
 #include "dive.h"
 
 double strtod_flags(const char *str, const char **ptr, unsigned int flags)
@@ -126,3 +128,111 @@ no_conversion:
 		*ptr = str;
 	return 0.0;
 }
+
+/*
+ * Parse a decimal number in the C locale straight into an integer scaled
+ * by 10 to the power 'decimals', rounding off any digits past that: with
+ * three decimals "12.3456" becomes 12346. That's what the depths,
+ * pressures and temperatures in the files get turned into anyway, so
+ * there is no need to go through a double for them.
+ *
+ * Numbers with an exponent, or with too many digits to fit, are left
+ * to strtod_flags(). Like that, 'ptr' is set to 'str' if there is no
+ * number at all.
+ */
+long strtol_scaled(const char *str, const char **ptr, int decimals)
+{
+	char c;
+	const char *p = str;
+	unsigned long val = 0;
+	int sign = 0, numbers = 0, dot = 0, fraction = 0, round = 0;
+	double fp;
+
+	while (isspace(c = *p))
+		p++;
+	switch (c) {
+	case '-':
+		sign = 1;
+	/* fallthrough */
+	case '+':
+		p++;
+	}
+
+	for (;; p++) {
+		c = *p;
+		if (c == '.' && !dot) {
+			dot = 1;
+			continue;
+		}
+		if (c < '0' || c > '9')
+			break;
+		numbers++;
+		if (dot && fraction >= decimals) {
+			if (fraction++ == decimals)
+				round = c >= '5';
+			continue;
+		}
+		if (val >= LONG_MAX / 10)
+			goto slow;
+		val = val * 10 + c - '0';
+		fraction += dot;
+	}
+
+	if (!numbers) {
+		if (ptr)
+			*ptr = str;
+		return 0;
+	}
+	if (c == 'e' || c == 'E')
+		goto slow;
+	for (; fraction < decimals; fraction++) {
+		if (val >= LONG_MAX / 10)
+			goto slow;
+		val *= 10;
+	}
+	val += round;
+	if (ptr)
+		*ptr = p;
+	return sign ? -(long)val : (long)val;
+
+slow:
+	fp = strtod_flags(str, ptr, STRTOD_ASCII);
+	while (decimals-- > 0)
+		fp *= 10;
+	return lrint(fp);
+}
+
+/*
+ * Parse a "mm:ss" time, as the samples and durations are written, into
+ * seconds. A plain number is taken as seconds.
+ */
+int strtoseconds(const char *str, const char **ptr)
+{
+	const char *p = str;
+	int sign = 0, val = 0, sec = 0;
+
+	while (isspace(*p))
+		p++;
+	switch (*p) {
+	case '-':
+		sign = 1;
+	/* fallthrough */
+	case '+':
+		p++;
+	}
+	if (*p < '0' || *p > '9') {
+		if (ptr)
+			*ptr = str;
+		return 0;
+	}
+	while (*p >= '0' && *p <= '9')
+		val = val * 10 + *p++ - '0';
+	if (*p == ':' && p[1] >= '0' && p[1] <= '9') {
+		for (p++; *p >= '0' && *p <= '9'; p++)
+			sec = sec * 10 + *p - '0';
+		val = val * 60 + sec;
+	}
+	if (ptr)
+		*ptr = p;
+	return sign ? -val : val;
+}
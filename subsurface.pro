@@ -27,6 +27,7 @@ HEADERS = \
 	display.h \
 	dive.h \
 	divelist.h \
+	divequery.h \
 	file.h \
 	gettextfromc.h \
 	gettext.h \
@@ -112,6 +113,9 @@ SOURCES =  \
 	device.c \
 	dive.c \
 	divelist.c \
+	divesummary.c \
+	divequery.c \
+	textindex.c \
 	equipment.c \
 	file.c \
 	gettextfromc.cpp \
@@ -122,6 +126,7 @@ SOURCES =  \
 	parse-xml.c \
 	planner.c \
 	profile.c \
+	sample-store.c \
 	gaspressures.c \
 	divecomputer.cpp \
 	worldmap-save.c \
@@ -155,6 +160,7 @@ SOURCES =  \
 	save-xml.c \
 	sha1.c \
 	statistics.c \
+	strpool.c \
 	strtod.c \
 	subsurfacestartup.c \
 	time.c \
@@ -72,6 +72,11 @@ static int sortfn(const void *_a, const void *_b)
 void sort_table(struct dive_table *table)
 {
 	qsort(table->dives, table->nr, sizeof(struct dive *), sortfn);
+	if (table == &dive_table) {
+		invalidate_dive_id_index();
+		invalidate_oxygen_exposure(0);
+		invalidate_dive_summary(0);
+	}
 }
 
 const char *weekday(int wday)
@@ -0,0 +1,133 @@
+#include "testdivequery.h"
+#include "dive.h"
+#include "divelist.h"
+#include "divequery.h"
+
+/* dive 0 has no water temperature, rating or sac */
+static const char test_dives[] =
+	"<divelog program='subsurface' version='2'>\n"
+	"<dives>\n"
+	"<dive number='1' date='2013-06-05' time='10:00:00' duration='30:00 min' tags='shore'>\n"
+	"  <location>Quarry</location>\n"
+	"  <buddy>John</buddy>\n"
+	"  <divecomputer model='manually added dive'>\n"
+	"  <depth max='12.0 m' mean='8.0 m' />\n"
+	"  </divecomputer>\n"
+	"</dive>\n"
+	"<dive number='2' rating='2' date='2013-07-20' time='09:00:00' duration='50:00 min' tags='wreck'>\n"
+	"  <location>Thistlegorm</location>\n"
+	"  <notes>Deep and dark</notes>\n"
+	"  <divecomputer model='manually added dive'>\n"
+	"  <depth max='45.0 m' mean='25.0 m' />\n"
+	"  <temperature water='10.0 C' />\n"
+	"  </divecomputer>\n"
+	"</dive>\n"
+	"<dive number='3' rating='4' date='2014-01-10' time='11:00:00' duration='40:00 min' tags='wreck, boat'>\n"
+	"  <location>Blue Hole</location>\n"
+	"  <buddy>Jane Doe</buddy>\n"
+	"  <cylinder size='12.0 l' workpressure='232.0 bar' start='200.0 bar' end='50.0 bar' />\n"
+	"  <divecomputer model='manually added dive'>\n"
+	"  <depth max='30.0 m' mean='15.0 m' />\n"
+	"  <temperature water='24.0 C' />\n"
+	"  </divecomputer>\n"
+	"</dive>\n"
+	"</dives>\n"
+	"</divelog>\n";
+
+/* the indexes of the matching dives, like "0,2", or "invalid" */
+static QString matches(const char *text)
+{
+	struct dive_query *query = compile_dive_query(text);
+	uint32_t bitmap[DIVE_BITMAP_WORDS(3)];
+	QStringList result;
+
+	if (!query)
+		return "invalid";
+	int count = run_dive_query(query, bitmap);
+	free_dive_query(query);
+	for (int i = 0; i < dive_table.nr; i++)
+		if (bitmap[i / 32] & (1u << (i & 31)))
+			result << QString::number(i);
+	if (count != result.count())
+		return "bad count";
+	return result.join(",");
+}
+
+void TestDiveQuery::initTestCase()
+{
+	prefs.units = SI_units;
+	parse_xml_init();
+	parse_xml_buffer("testdivequery", test_dives, strlen(test_dives), &dive_table, NULL);
+	QCOMPARE(dive_table.nr, 3);
+	for (int i = 0; i < dive_table.nr; i++)
+		update_cylinder_related_info(dive_table.dives[i]);
+}
+
+void TestDiveQuery::testPrecedence()
+{
+	QCOMPARE(matches("depth > 20 or depth < 15 and year = 2014"), QString("1,2"));
+	QCOMPARE(matches("(depth > 20 or depth < 15) and year = 2013"), QString("0,1"));
+	QCOMPARE(matches("year = 2013 depth > 20"), QString("1"));
+	QCOMPARE(matches("duration >= 40 and month = 1"), QString("2"));
+}
+
+void TestDiveQuery::testNot()
+{
+	QCOMPARE(matches("not tag = wreck"), QString("0"));
+	QCOMPARE(matches("tag != wreck"), QString("0"));
+	QCOMPARE(matches("not (year = 2013 and depth < 20)"), QString("1,2"));
+	QCOMPARE(matches("not not tag = boat"), QString("2"));
+	QCOMPARE(matches("not depth > 20 or tag = boat"), QString("0,2"));
+}
+
+void TestDiveQuery::testText()
+{
+	QCOMPARE(matches("location = \"Blue Hole\""), QString("2"));
+	QCOMPARE(matches("location = blue"), QString(""));
+	QCOMPARE(matches("buddy ~ \"jane\""), QString("2"));
+	QCOMPARE(matches("buddy contains doe"), QString("2"));
+	QCOMPARE(matches("\"thistle\""), QString("1"));
+	QCOMPARE(matches("wreck boat"), QString("2"));
+	QCOMPARE(matches("thistle or quarry"), QString("0,1"));
+}
+
+void TestDiveQuery::testUnknownValues()
+{
+	QCOMPARE(matches("temp < 20"), QString("1"));
+	QCOMPARE(matches("temp != 24"), QString("1"));
+	QCOMPARE(matches("rating = 0"), QString(""));
+	QCOMPARE(matches("rating < 3"), QString("1"));
+	QCOMPARE(matches("rating != 4"), QString("1"));
+	QCOMPARE(matches("sac < 30"), QString("2"));
+	QCOMPARE(matches("not sac < 30"), QString("0,1"));
+	QCOMPARE(matches("meandepth < 10"), QString("0"));
+}
+
+void TestDiveQuery::testUnits()
+{
+	prefs.units = IMPERIAL_units;
+	QCOMPARE(matches("depth > 100"), QString("1"));
+	QCOMPARE(matches("depth < 50"), QString("0"));
+	QCOMPARE(matches("temp > 60"), QString("2"));
+	QCOMPARE(matches("sac < 1 and sac > 0.5"), QString("2"));
+	prefs.units = SI_units;
+	QCOMPARE(matches("depth > 100"), QString(""));
+	QCOMPARE(matches("temp > 20"), QString("2"));
+}
+
+void TestDiveQuery::testInvalid()
+{
+	QCOMPARE(matches(""), QString("invalid"));
+	QCOMPARE(matches("depth >"), QString("invalid"));
+	QCOMPARE(matches("depth ~ 3"), QString("invalid"));
+	QCOMPARE(matches("depth = abc"), QString("invalid"));
+	QCOMPARE(matches("(depth > 3"), QString("invalid"));
+	QCOMPARE(matches("depth > 3)"), QString("invalid"));
+	QCOMPARE(matches("depth > 3 or"), QString("invalid"));
+	QCOMPARE(matches("not"), QString("invalid"));
+	QCOMPARE(matches("foo = 3"), QString("invalid"));
+	QCOMPARE(matches("\"depth\" > 3"), QString("invalid"));
+	QCOMPARE(matches("location < x"), QString("invalid"));
+}
+
+QTEST_MAIN(TestDiveQuery)
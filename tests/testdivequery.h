@@ -0,0 +1,18 @@
+#ifndef TESTDIVEQUERY_H
+#define TESTDIVEQUERY_H
+
+#include <QtTest>
+
+class TestDiveQuery : public QObject{
+	Q_OBJECT
+private slots:
+	void initTestCase();
+	void testPrecedence();
+	void testNot();
+	void testText();
+	void testUnknownValues();
+	void testUnits();
+	void testInvalid();
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "testparsenumbers.h"
+#include "dive.h"
+
+/* what the sample values in the files look like */
+static const char *samples[] = {
+	"12.3 m", "0.0 m", "45.678 m", "1.5 m", "203.4 bar", "198.0 bar",
+	"24.2 C", "-1.75 C", "3.05 m", "17 m", "9.99 m", "0.125 bar"
+};
+
+#define NR_SAMPLES (sizeof(samples) / sizeof(samples[0]))
+
+void TestParseNumbers::testScaledNumbers()
+{
+	const char *end;
+
+	QCOMPARE(strtol_scaled("12.3 m", &end, 3), 12300L);
+	QCOMPARE(*end, ' ');
+	QCOMPARE(strtol_scaled("-1.75", NULL, 3), -1750L);
+	QCOMPARE(strtol_scaled("+7", NULL, 3), 7000L);
+	QCOMPARE(strtol_scaled("  .5", NULL, 3), 500L);
+	QCOMPARE(strtol_scaled("12.3456", NULL, 3), 12346L);
+	QCOMPARE(strtol_scaled("12.3454", NULL, 3), 12345L);
+	/* no binary fraction in the way of rounding a decimal half up */
+	QCOMPARE(strtol_scaled("3.0005", NULL, 3), 3001L);
+	QCOMPARE(strtol_scaled("1.5", NULL, 1), 15L);
+	QCOMPARE(strtol_scaled("1.25e1", NULL, 3), 12500L);
+	QCOMPARE(strtol_scaled("1.2.3", &end, 3), 1200L);
+	QCOMPARE(*end, '.');
+	QCOMPARE(strtol_scaled("m", &end, 3), 0L);
+	QCOMPARE(*end, 'm');
+	QCOMPARE(strtol_scaled("-", &end, 3), 0L);
+	QCOMPARE(*end, '-');
+	for (unsigned i = 0; i < NR_SAMPLES; i++)
+		QCOMPARE(strtol_scaled(samples[i], NULL, 3), lrint(1000 * ascii_strtod(samples[i], NULL)));
+}
+
+void TestParseNumbers::testSeconds()
+{
+	const char *end;
+
+	QCOMPARE(strtoseconds("1:30 min", &end), 90);
+	QCOMPARE(*end, ' ');
+	QCOMPARE(strtoseconds("45", NULL), 45);
+	QCOMPARE(strtoseconds("0:05", NULL), 5);
+	QCOMPARE(strtoseconds("123:00 min", NULL), 7380);
+	QCOMPARE(strtoseconds("-1:00", NULL), -60);
+	QCOMPARE(strtoseconds("min", &end), 0);
+	QCOMPARE(*end, 'm');
+}
+
+void TestParseNumbers::benchmarkStrtod()
+{
+	long sum = 0;
+
+	QBENCHMARK {
+		for (unsigned i = 0; i < NR_SAMPLES; i++)
+			sum += lrint(1000 * ascii_strtod(samples[i], NULL));
+	}
+	QVERIFY(sum);
+}
+
+void TestParseNumbers::benchmarkScaled()
+{
+	long sum = 0;
+
+	QBENCHMARK {
+		for (unsigned i = 0; i < NR_SAMPLES; i++)
+			sum += strtol_scaled(samples[i], NULL, 3);
+	}
+	QVERIFY(sum);
+}
+
+QTEST_MAIN(TestParseNumbers)
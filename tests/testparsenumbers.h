@@ -0,0 +1,15 @@
+#ifndef TESTPARSENUMBERS_H
+#define TESTPARSENUMBERS_H
+
+#include <QtTest>
+
+class TestParseNumbers : public QObject{
+	Q_OBJECT
+private slots:
+	void testScaledNumbers();
+	void testSeconds();
+	void benchmarkStrtod();
+	void benchmarkScaled();
+};
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * Inverted index of the words in the text fields of the dives.
+ *
+ * Every word that appears in the notes, location, buddy, divemaster or
+ * suit of a dive, or in the name of one of its tags, is kept in a sorted
+ * vocabulary together with the ids of the dives that use it. Looking up
+ * what the user typed into the search box is then a binary search for
+ * the range of words that start with it, instead of formatting and
+ * scanning the text of every dive on every key press.
+ *
+ * The index is keyed by dive id, so moving dives around in the table
+ * doesn't affect it. Dives that aren't in it yet are picked up on the next
+ * lookup, edits to a dive have to be reported through
+ * update_dive_text_index() and deleted dives through
+ * remove_dive_text_index(). Ids of dives that have gone away without
+ * that are simply skipped.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "dive.h"
+
+struct text_word {
+	char *word;
+	int nr, allocated;
+	int *ids;
+};
+
+/* all words ever seen, sorted */
+static struct {
+	int nr, allocated;
+	struct text_word *words;
+} vocabulary;
+
+/* the words each dive is listed under, so they can be taken out again */
+struct dive_words {
+	int id;
+	bool indexed;
+	int nr;
+	const char **words;
+};
+
+static struct {
+	int size, used;
+	struct dive_words *entries;
+} dive_words_table;
+
+static inline unsigned int dive_words_hash(int id)
+{
+	unsigned int h = (unsigned int)id * 2654435761u;
+	return h ^ (h >> 16);
+}
+
+/* entries are never removed, ids don't get reused */
+static struct dive_words *dive_words_slot(int id)
+{
+	unsigned int mask = dive_words_table.size - 1;
+	unsigned int i = dive_words_hash(id) & mask;
+
+	while (dive_words_table.entries[i].id && dive_words_table.entries[i].id != id)
+		i = (i + 1) & mask;
+	return dive_words_table.entries + i;
+}
+
+/* make room for one more entry, dropping the ones of removed dives */
+static void grow_dive_words_table(void)
+{
+	struct dive_words *old = dive_words_table.entries;
+	int i, old_size = dive_words_table.size, size = 64, live = 0;
+
+	for (i = 0; i < old_size; i++)
+		live += old[i].indexed;
+	while (size < 2 * (live + 1) + 2)
+		size *= 2;
+	dive_words_table.entries = calloc(size, sizeof(struct dive_words));
+	if (!dive_words_table.entries)
+		exit(1);
+	dive_words_table.size = size;
+	dive_words_table.used = 0;
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].indexed)
+			continue;
+		*dive_words_slot(old[i].id) = old[i];
+		dive_words_table.used++;
+	}
+	free(old);
+}
+
+static struct dive_words *lookup_dive_words(int id, bool create)
+{
+	struct dive_words *entry;
+
+	if (!dive_words_table.size) {
+		if (!create)
+			return NULL;
+		grow_dive_words_table();
+	}
+	entry = dive_words_slot(id);
+	if (entry->id || !create)
+		return entry->id ? entry : NULL;
+	if (2 * (dive_words_table.used + 1) > dive_words_table.size) {
+		grow_dive_words_table();
+		entry = dive_words_slot(id);
+	}
+	entry->id = id;
+	dive_words_table.used++;
+	return entry;
+}
+
+/* the position of the first word in the vocabulary that is >= word */
+static int vocabulary_bound(const char *word)
+{
+	int low = 0, high = vocabulary.nr;
+
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (strcmp(vocabulary.words[mid].word, word) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+static struct text_word *find_word(const char *word, bool create)
+{
+	int i = vocabulary_bound(word);
+	struct text_word *w;
+
+	if (i < vocabulary.nr && !strcmp(vocabulary.words[i].word, word))
+		return vocabulary.words + i;
+	if (!create)
+		return NULL;
+	if (vocabulary.nr == vocabulary.allocated) {
+		vocabulary.allocated = (vocabulary.nr + 32) * 3 / 2;
+		vocabulary.words = realloc(vocabulary.words, vocabulary.allocated * sizeof(struct text_word));
+		if (!vocabulary.words)
+			exit(1);
+	}
+	w = vocabulary.words + i;
+	memmove(w + 1, w, (vocabulary.nr - i) * sizeof(struct text_word));
+	vocabulary.nr++;
+	memset(w, 0, sizeof(*w));
+	w->word = strdup(word);
+	return w;
+}
+
+static void add_id(struct text_word *w, int id)
+{
+	if (w->nr == w->allocated) {
+		w->allocated = (w->nr + 4) * 3 / 2;
+		w->ids = realloc(w->ids, w->allocated * sizeof(int));
+		if (!w->ids)
+			exit(1);
+	}
+	w->ids[w->nr++] = id;
+}
+
+static void remove_id(struct text_word *w, int id)
+{
+	int i;
+
+	for (i = 0; i < w->nr; i++) {
+		if (w->ids[i] == id) {
+			w->ids[i] = w->ids[--w->nr];
+			return;
+		}
+	}
+}
+
+static bool is_word_byte(unsigned char c)
+{
+	/* bytes of multi-byte UTF-8 characters are part of the word */
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+/*
+ * Call 'fn' for each word in 'text', lower-cased in 'buf'. Words that
+ * don't fit into the buffer are cut short, which still finds them by
+ * their beginning.
+ */
+static void for_each_word(const char *text, void (*fn)(const char *word, void *data), void *data)
+{
+	char buf[64];
+	int len;
+
+	if (!text)
+		return;
+	while (*text) {
+		while (*text && !is_word_byte(*text))
+			text++;
+		for (len = 0; is_word_byte(*text); text++) {
+			if (len < (int)sizeof(buf) - 1)
+				buf[len++] = *text >= 'A' && *text <= 'Z' ? *text + 'a' - 'A' : *text;
+		}
+		if (len) {
+			buf[len] = '\0';
+			fn(buf, data);
+		}
+	}
+}
+
+struct word_list {
+	int nr, allocated;
+	const char **words;
+};
+
+static void collect_word(const char *word, void *data)
+{
+	struct word_list *list = data;
+	struct text_word *w = find_word(word, true);
+	int i;
+
+	/* the word pointers are the vocabulary's, so they can be compared */
+	for (i = 0; i < list->nr; i++)
+		if (list->words[i] == w->word)
+			return;
+	if (list->nr == list->allocated) {
+		list->allocated = (list->nr + 8) * 2;
+		list->words = realloc(list->words, list->allocated * sizeof(char *));
+		if (!list->words)
+			exit(1);
+	}
+	list->words[list->nr++] = w->word;
+}
+
+static void unindex_entry(struct dive_words *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->nr; i++)
+		remove_id(find_word(entry->words[i], false), entry->id);
+	free(entry->words);
+	entry->words = NULL;
+	entry->nr = 0;
+	entry->indexed = false;
+}
+
+static void index_dive(struct dive *dive)
+{
+	struct dive_words *entry = lookup_dive_words(dive->id, true);
+	struct word_list list = { 0 };
+	struct tag_entry *tag;
+	int i;
+
+	if (entry->indexed)
+		unindex_entry(entry);
+	for_each_word(dive->notes, collect_word, &list);
+	for_each_word(dive->location, collect_word, &list);
+	for_each_word(dive->buddy, collect_word, &list);
+	for_each_word(dive->divemaster, collect_word, &list);
+	for_each_word(dive->suit, collect_word, &list);
+	for (tag = dive->tag_list; tag; tag = tag->next)
+		for_each_word(tag->tag->name, collect_word, &list);
+	for (i = 0; i < list.nr; i++)
+		add_id(find_word(list.words[i], false), dive->id);
+	entry->words = list.words;
+	entry->nr = list.nr;
+	entry->indexed = true;
+}
+
+/* the text or the tags of the dive were edited */
+void update_dive_text_index(struct dive *dive)
+{
+	struct dive_words *entry;
+
+	if (!dive || !dive->id)
+		return;
+	/* dives that were never indexed will be when they are looked up */
+	entry = lookup_dive_words(dive->id, false);
+	if (entry && entry->indexed)
+		index_dive(dive);
+}
+
+void remove_dive_text_index(struct dive *dive)
+{
+	struct dive_words *entry;
+
+	if (!dive || !dive->id)
+		return;
+	entry = lookup_dive_words(dive->id, false);
+	if (entry && entry->indexed)
+		unindex_entry(entry);
+}
+
+/* add the dives of the table that aren't in the index yet */
+static void sync_text_index(void)
+{
+	int i;
+	struct dive *dive;
+
+	for_each_dive(i, dive) {
+		struct dive_words *entry;
+
+		if (!dive->id)
+			continue;
+		entry = lookup_dive_words(dive->id, false);
+		if (!entry || !entry->indexed)
+			index_dive(dive);
+	}
+}
+
+struct prefix_search {
+	uint32_t *bitmap, *word_bitmap;
+	int words;
+	bool first;
+};
+
+/* and the dives that have a word starting with 'prefix' into the result */
+static void search_prefix(const char *prefix, void *data)
+{
+	struct prefix_search *search = data;
+	size_t len = strlen(prefix);
+	int i, j;
+
+	memset(search->word_bitmap, 0, search->words * sizeof(uint32_t));
+	for (i = vocabulary_bound(prefix); i < vocabulary.nr; i++) {
+		struct text_word *w = vocabulary.words + i;
+
+		if (strncmp(w->word, prefix, len))
+			break;
+		for (j = 0; j < w->nr; j++) {
+			int idx = lookup_idx_by_uniq_id(w->ids[j]);
+			if (idx >= 0)
+				search->word_bitmap[idx / 32] |= 1u << (idx & 31);
+		}
+	}
+	for (i = 0; i < search->words; i++) {
+		if (search->first)
+			search->bitmap[i] = search->word_bitmap[i];
+		else
+			search->bitmap[i] &= search->word_bitmap[i];
+	}
+	search->first = false;
+}
+
+/*
+ * Set the bits (one per dive in dive_table) of the dives that for every
+ * word in 'text' have a word starting with it in their text or tags.
+ * Returns false if 'text' has no words at all.
+ */
+bool search_dive_text(const char *text, uint32_t *bitmap)
+{
+	struct prefix_search search;
+
+	sync_text_index();
+	search.words = DIVE_BITMAP_WORDS(dive_table.nr);
+	search.bitmap = bitmap;
+	search.word_bitmap = malloc((search.words + 1) * sizeof(uint32_t));
+	if (!search.word_bitmap)
+		exit(1);
+	search.first = true;
+	for_each_word(text, search_prefix, &search);
+	free(search.word_bitmap);
+	if (search.first)
+		memset(bitmap, 0, search.words * sizeof(uint32_t));
+	return !search.first;
+}
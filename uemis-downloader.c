@@ -97,7 +97,7 @@ static void uemis_add_string(const char *buffer, char **text)
 		strcpy(buf, *text);
 		strcat(buf, " ");
 		strcat(buf, buffer);
-		free(*text);
+		release_string(*text);
 		*text = buf;
 	}
 }
@@ -785,6 +785,7 @@ static bool process_raw_buffer(uint32_t deviceid, char *inbuf, char **max_divenr
 		if (done && ++bp < endptr && *bp != '{' && strstr(bp, "{{")) {
 			done = false;
 			record_dive(dive);
+			dc_index_add(dive);
 			mark_divelist_changed(true);
 			dive = uemis_start_dive(deviceid);
 		}
@@ -792,6 +793,7 @@ static bool process_raw_buffer(uint32_t deviceid, char *inbuf, char **max_divenr
 	if (log) {
 		if (dive->dc.diveid) {
 			record_dive(dive);
+			dc_index_add(dive);
 			mark_divelist_changed(true);
 		} else { /* partial dive */
 			free(dive);
@@ -840,6 +842,7 @@ const char *do_uemis_import(const char *mountpath, short force_download)
 	uemis_info(translate("gettextFromC", "Init Communication"));
 	if (!uemis_init(mountpath))
 		return translate("gettextFromC", "Uemis init failed");
+	build_dc_index(dive_table.nr);
 	if (!uemis_get_answer(mountpath, "getDeviceId", 0, 1, &result))
 		goto bail;
 	deviceid = strdup(param_buff[0]);
@@ -971,5 +974,6 @@ bail:
 			result = param_buff[2];
 	}
 	free(deviceid);
+	free_dc_index();
 	return result;
 }